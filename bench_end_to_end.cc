@@ -4,7 +4,7 @@ using namespace std;
 
 int main(int argc, char** argv) {
   if ((argc != 4) && (argc != 5)) {
-    std::cout << "usage: " << argv[0] << " <data_file> <lookup_file> <index(rs|ts)> [max_error]" << endl;
+    std::cout << "usage: " << argv[0] << " <data_file> <lookup_file> <index(rs|rs_view|ts)> [max_error]" << endl;
     exit(-1);
   }
 
@@ -16,6 +16,8 @@ int main(int argc, char** argv) {
   if (data_file.find("32") != string::npos) {
     if (index_type == "rs")
       util::RunRS<uint32_t>(data_file, lookup_file);
+    else if (index_type == "rs_view")
+      util::RunRS<uint32_t, rs::RadixSplineView<uint32_t>>(data_file, lookup_file);
     else if ((index_type == "ts") && (!max_error))
       util::RunTS<uint32_t>(data_file, lookup_file);
     else
@@ -23,6 +25,8 @@ int main(int argc, char** argv) {
   } else {
     if (index_type == "rs")
       util::RunRS<uint64_t>(data_file, lookup_file);
+    else if (index_type == "rs_view")
+      util::RunRS<uint64_t, rs::RadixSplineView<uint64_t>>(data_file, lookup_file);
     else if ((index_type == "ts") && (!max_error))
       util::RunTS<uint64_t>(data_file, lookup_file);
     else
@@ -1,14 +1,28 @@
+#pragma once
+
 #include <chrono>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <type_traits>
+
+#include <boost/serialization/version.hpp>
 
 #include "include/rs/multi_map.h"
+#include "include/rs/serializer.h"
+#include "include/ts/block_vector.h"
+#include "include/ts/bloom_filter.h"
 #include "include/ts/builder.h"
+#include "include/ts/compact_ts.h"
+#include "include/ts/index_file.h"
+#include "include/ts/position_cache.h"
+#include "include/ts/string_ts.h"
 #include "include/ts/ts.h"
+#include "include/ts/ts32.h"
 
 using namespace std;
 
@@ -244,7 +258,9 @@ static vector<pair<KeyType, uint64_t>> add_values(const vector<KeyType>& keys) {
 
 // namespace {
 
-template <class KeyType, class ValueType>
+// `Model` is either `rs::RadixSpline` or `rs::RadixSplineView`, which serves
+// lookups from the spline serialized in the bulk format (`bulk_`).
+template <class KeyType, class ValueType, class Model = rs::RadixSpline<KeyType>>
 class NonOwningMultiMapRS {
  public:
   using element_type = pair<KeyType, ValueType>;
@@ -263,7 +279,12 @@ class NonOwningMultiMapRS {
     for (const auto& iter : data_) {
       rsb.AddKey(iter.first);
     }
-    rs_ = rsb.Finalize();
+    if constexpr (std::is_same<Model, rs::RadixSplineView<KeyType>>::value) {
+      rs::Serializer<KeyType>::ToBulkBytes(rsb.Finalize(), &bulk_);
+      rs_ = Model(bulk_.data(), bulk_.size());
+    } else {
+      rs_ = rsb.Finalize();
+    }
   }
 
   typename vector<element_type>::const_iterator lower_bound(KeyType key) const {
@@ -288,42 +309,119 @@ class NonOwningMultiMapRS {
 
  private:
   const vector<element_type>& data_;
-  rs::RadixSpline<KeyType> rs_;
+  std::string bulk_;
+  Model rs_;
 };
 
+// A (key, value) record without padding, e.g. 12 bytes instead of 16 for
+// 32-bit keys and 64-bit values.
+template <class KeyType, class ValueType>
+struct __attribute__((packed)) PackedRecord {
+  KeyType first;
+  ValueType second;
+};
+
+// `LazyVector` fills that copy keys or values straight out of `elements`, for
+// the multimaps that store them in separate files.
+template <class KeyType, class ValueType>
+auto KeysOf(const vector<pair<KeyType, ValueType>>& elements) {
+  return [&elements](KeyType* out, size_t begin, size_t count) {
+    for (size_t idx = 0; idx < count; ++idx) out[idx] = elements[begin + idx].first;
+  };
+}
+
 template <class KeyType, class ValueType>
+auto ValuesOf(const vector<pair<KeyType, ValueType>>& elements) {
+  return [&elements](ValueType* out, size_t begin, size_t count) {
+    for (size_t idx = 0; idx < count; ++idx) out[idx] = elements[begin + idx].second;
+  };
+}
+
+// Builds an `Index` over the sorted keys `key_at(0..num_keys)`. A
+// `ts::TrieSpline` keeps its arrays under `root_path`; the compact encodings
+// are converted from a spline kept in memory, which leaves no files behind.
+template <class Index, class KeyType, class KeyAt>
+Index BuildIndex(size_t num_keys, KeyAt key_at, const ts::ErrorProfile<KeyType>& profile,
+                 fs::path root_path) {
+  assert(num_keys > 0);
+  constexpr bool in_files = std::is_same<Index, ts::TrieSpline<KeyType>>::value;
+  ts::Builder<KeyType> tsb(key_at(0), key_at(num_keys - 1), profile,
+                           in_files ? root_path : fs::path());
+  for (size_t idx = 0; idx < num_keys; ++idx) tsb.AddKey(key_at(idx));
+  if constexpr (in_files) {
+    return tsb.Finalize();
+  } else {
+    return Index(tsb.Finalize());
+  }
+}
+
+// Builds an `Index` over the keys of the sorted `elements`.
+template <class Index, class KeyType, class ValueType>
+Index BuildIndex(const vector<pair<KeyType, ValueType>>& elements, size_t max_error,
+                 fs::path root_path) {
+  return BuildIndex<Index>(
+      elements.size(), [&elements](size_t idx) { return elements[idx].first; },
+      ts::ErrorProfile<KeyType>(max_error), root_path);
+}
+
+// `Index` is either `ts::TrieSpline` or its compact encodings
+// `ts::CompactTrieSpline` and `ts::TrieSpline32`, and `Record` the layout of
+// an element in the data file. With `filter_bits_per_key > 0`, a Bloom filter
+// over the keys (`filter`) lets `find` and `sum_up` return for absent keys
+// without touching the data file. `EnableCache` puts a cache of looked up
+// positions in front of the index.
+template <class KeyType, class ValueType, class Index = ts::TrieSpline<KeyType>,
+          class Record = pair<KeyType, ValueType>>
 class NonOwningMultiMapTS {
  public:
-  using element_type = pair<KeyType, ValueType>;
-
-  NonOwningMultiMapTS(const vector<element_type>& elements, size_t max_error, fs::path root_path)
-      : data_(elements, root_path / "data"), root_path_(root_path) {
+  using element_type = Record;
+
+  // With a sample of the keys to be looked up, the spline has tighter errors
+  // where lookups are frequent (see `ts::Builder::ProfileErrors`).
+  NonOwningMultiMapTS(const vector<pair<KeyType, ValueType>>& elements, size_t max_error,
+                      fs::path root_path, size_t filter_bits_per_key = 0,
+                      const vector<KeyType>& query_sample = {})
+      : data_(elements.size(), root_path / "data",
+              [&elements](element_type* out, size_t begin, size_t count) {
+                for (size_t idx = 0; idx < count; ++idx) {
+                  out[idx] = element_type{elements[begin + idx].first, elements[begin + idx].second};
+                }
+              }),
+        filter_(elements.size(), [&elements](size_t idx) { return elements[idx].first; },
+                filter_bits_per_key, root_path / "filter"),
+        root_path_(root_path) {
     assert(elements.size() > 0);
 
-    // Create spline builder.
-    const auto min_key = data_.front().first;
-    const auto max_key = data_.back().first;
-    ts::Builder<KeyType> tsb(min_key, max_key, max_error, root_path);
+    // Fit the spline errors to the lookups, if sampled.
+    ts::ErrorProfile<KeyType> profile(max_error);
+    if (!query_sample.empty()) {
+      vector<KeyType> keys(elements.size());
+      for (size_t idx = 0; idx < elements.size(); ++idx) keys[idx] = elements[idx].first;
+      profile = ts::Builder<KeyType>::ProfileErrors(keys, query_sample, max_error);
+      std::cout << "Profiled spline errors over " << profile.GetNumRegions()
+                << " regions, up to " << profile.GetMaxError() << std::endl;
+    }
 
-    // Build TS.
-    for (const auto& iter : data_) tsb.AddKey(iter.first);
-    ts_ = tsb.Finalize();
+    ts_ = BuildIndex<Index>(
+        data_.size(), [this](size_t idx) { return data_[idx].first; }, profile, root_path);
   }
 
   typename mmap_struct::LazyVector<element_type>::Iterator lower_bound(KeyType key) const {
-    ts::SearchBound bound = ts_.GetSearchBound(key);
-    // std::cout << "bound: begin= " << bound.begin << ", end= " << bound.end << std::endl;
-    return ::lower_bound(data_.begin() + bound.begin, data_.begin() + bound.end,
-                         key, [](const element_type& lhs, const KeyType& rhs) {
-                          //  std::cout << "lhs= " << lhs.first << std::endl;
-                          //  std::cout << "rhs= " << rhs << std::endl;
-                           return lhs.first < rhs;
-                         });
+    return data_.begin() + lower_bound_position(key);
   }
 
+  // Returns the first element with key `key`, or `end()`.
+  typename mmap_struct::LazyVector<element_type>::Iterator find(KeyType key) const {
+    if (!filter_.MayContain(key)) return data_.end();
+    auto iter = lower_bound(key);
+    return (iter != data_.end() && iter->first == key) ? iter : data_.end();
+  }
+
+  typename mmap_struct::LazyVector<element_type>::Iterator end() const { return data_.end(); }
+
   uint64_t sum_up(KeyType key) const {
     uint64_t result = 0;
-    auto iter = lower_bound(key);
+    auto iter = find(key);
     while (iter != data_.end() && iter->first == key) {
       result += iter->second;
       ++iter;
@@ -331,7 +429,18 @@ class NonOwningMultiMapTS {
     return result;
   }
 
-  size_t GetSizeInByte() const { return ts_.GetSize(); }
+  size_t GetSizeInByte() const { return ts_.GetSize() + filter_.GetSizeInByte(); }
+
+  const Index& GetIndex() const { return ts_; }
+
+  // Caches the positions of about `num_entries` looked up keys, which then
+  // bypass the index (see `ts::PositionCache`). The cache is not saved.
+  void EnableCache(size_t num_entries, bool count_lookups = false) {
+    cache_ = std::make_unique<ts::PositionCache<KeyType>>(num_entries, count_lookups);
+  }
+
+  // Returns the cache, or null if disabled.
+  const ts::PositionCache<KeyType>* GetCache() const { return cache_.get(); }
 
   /* Save-load */
 
@@ -345,7 +454,8 @@ class NonOwningMultiMapTS {
   }
 
   // Load under path
-  NonOwningMultiMapTS(fs::path root_path) : ts_(root_path), root_path_(root_path) {
+  NonOwningMultiMapTS(fs::path root_path)
+      : ts_(root_path), filter_(root_path / "filter"), root_path_(root_path) {
     fs::path meta_path = this->make_meta_path();
     std::ifstream ifs(meta_path);
     boost::archive::binary_iarchive ia(ifs);
@@ -353,15 +463,67 @@ class NonOwningMultiMapTS {
     std::cout << "Loaded NonOwningMultiMapTS from " << meta_path << std::endl;
   }
 
+  // Adopt a data file already written under path, and its finished index
+  NonOwningMultiMapTS(fs::path root_path, size_t data_size, Index&& ts)
+      : data_(root_path / "data", data_size), root_path_(root_path) {
+    ts_ = std::move(ts);
+  }
+
+  // Save data and index into a single file under path (see
+  // `mmap_struct::IndexFile`). The filter is not included.
+  void save_to_index_file() const {
+    mmap_struct::IndexFile::Writer writer;
+    writer.Add(mmap_struct::IndexFile::Data, data_.data(), data_.size() * sizeof(element_type));
+    ts_.AddSections(writer);
+    writer.Write(this->make_index_path());
+  }
+
+  // Load from a single index file, mapping every component in place
+  NonOwningMultiMapTS(std::shared_ptr<const mmap_struct::IndexFile> file)
+      : ts_(*file), file_(std::move(file)) {
+    size_t data_size;
+    const auto* data = file_->template GetArray<element_type>(mmap_struct::IndexFile::Data, &data_size);
+    data_ = mmap_struct::LazyVector<element_type>(data, data_size);
+  }
+
+  static fs::path make_index_path(fs::path root_path) {
+    return root_path / "index";
+  }
+
  private:
   mmap_struct::LazyVector<element_type> data_;
-  ts::TrieSpline<KeyType> ts_;
+  Index ts_;
+  mmap_struct::BlockedBloomFilter<KeyType> filter_;
+  std::unique_ptr<ts::PositionCache<KeyType>> cache_;
   fs::path root_path_;
+  std::shared_ptr<const mmap_struct::IndexFile> file_;
+
+  // Returns the position of the first element not less than `key`, or
+  // `data_.size()`.
+  size_t lower_bound_position(KeyType key) const {
+    size_t position;
+    if (cache_ && cache_->Lookup(key, position)) return position;
+
+    // Search on raw pointers, since `LazyVector::Iterator` is not random
+    // access.
+    ts::SearchBound bound = ts_.GetSearchBound(key);
+    const element_type* data = data_.data();
+    position = ::lower_bound(data + bound.begin, data + bound.end, key,
+                             [](const element_type& lhs, const KeyType& rhs) {
+                               return lhs.first < rhs;
+                             }) - data;
+    if (cache_) cache_->Insert(key, position);
+    return position;
+  }
 
   fs::path make_meta_path() const {
     return this->root_path_ / "meta";
   }
 
+  fs::path make_index_path() const {
+    return make_index_path(this->root_path_);
+  }
+
   fs::path make_data_path() const {
     return this->root_path_ / "data";
   }
@@ -375,14 +537,468 @@ class NonOwningMultiMapTS {
     // std::cout << "NonOwningMultiMapTS::save" << std::endl;
     ar << this->data_.size();  // data_size
     ar << this->ts_;
+    ar << this->filter_;
   }
 
   template<class Archive>
-  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+  void load(Archive & ar, const unsigned int version) {
     // std::cout << "NonOwningMultiMapTS::load" << std::endl;
     size_t data_size; ar >> data_size;
     this->data_ = mmap_struct::LazyVector<element_type>(this->make_data_path(), data_size);
     ar >> this->ts_;
+    if (version >= 1) ar >> this->filter_;
+  }
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+// `NonOwningMultiMapTS` for 32-bit keys and fewer than 2^32 elements, with a
+// `ts::TrieSpline32` and packed records.
+template <class KeyType, class ValueType>
+using PackedMultiMapTS = NonOwningMultiMapTS<KeyType, ValueType, ts::TrieSpline32<KeyType>,
+                                             PackedRecord<KeyType, ValueType>>;
+
+// Same as `NonOwningMultiMapTS`, but stores keys and values in two separate
+// files (`keys` and `values`). The last-mile search only touches keys; the
+// value is fetched once at the final position.
+template <class KeyType, class ValueType, class Index = ts::TrieSpline<KeyType>>
+class ColumnarMultiMapTS {
+ public:
+  using element_type = pair<KeyType, ValueType>;
+
+  ColumnarMultiMapTS(const vector<element_type>& elements, size_t max_error, fs::path root_path)
+      : keys_(elements.size(), root_path / "keys", KeysOf(elements)),
+        values_(elements.size(), root_path / "values", ValuesOf(elements)),
+        root_path_(root_path) {
+    assert(elements.size() > 0);
+
+    ts_ = BuildIndex<Index>(elements, max_error, root_path);
+  }
+
+  // Returns the position of the first key not less than `key`, or `size()`.
+  size_t lower_bound(KeyType key) const {
+    ts::SearchBound bound = ts_.GetSearchBound(key);
+    auto first = keys_.data() + bound.begin;
+    auto last = keys_.data() + bound.end;
+    return ::lower_bound(first, last, key) - keys_.data();
+  }
+
+  KeyType key_at(size_t pos) const { return keys_[pos]; }
+  ValueType value_at(size_t pos) const { return values_[pos]; }
+  size_t size() const { return keys_.size(); }
+
+  uint64_t sum_up(KeyType key) const {
+    // Find the run of duplicates in `keys_` first, then touch `values_` once.
+    const size_t begin = lower_bound(key);
+    size_t end = begin;
+    while (end < keys_.size() && keys_[end] == key) ++end;
+
+    uint64_t result = 0;
+    for (size_t pos = begin; pos < end; ++pos) result += values_[pos];
+    return result;
+  }
+
+  size_t GetSizeInByte() const { return ts_.GetSize(); }
+
+  /* Save-load */
+
+  // Save to file
+  void save_to_file() const {
+    fs::path meta_path = this->make_meta_path();
+    std::ofstream ofs(meta_path);
+    boost::archive::binary_oarchive oa(ofs);
+    oa << (*this);
+    std::cout << "Saved ColumnarMultiMapTS to " << meta_path << std::endl;
+  }
+
+  // Load under path
+  ColumnarMultiMapTS(fs::path root_path) : ts_(root_path), root_path_(root_path) {
+    fs::path meta_path = this->make_meta_path();
+    std::ifstream ifs(meta_path);
+    boost::archive::binary_iarchive ia(ifs);
+    ia >> (*this);
+    std::cout << "Loaded ColumnarMultiMapTS from " << meta_path << std::endl;
+  }
+
+ private:
+  mmap_struct::LazyVector<KeyType> keys_;
+  mmap_struct::LazyVector<ValueType> values_;
+  Index ts_;
+  fs::path root_path_;
+
+  fs::path make_meta_path() const {
+    return this->root_path_ / "meta";
+  }
+
+  fs::path make_keys_path() const {
+    return this->root_path_ / "keys";
+  }
+
+  fs::path make_values_path() const {
+    return this->root_path_ / "values";
+  }
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void save(Archive & ar, const unsigned int version __attribute__((unused))) const {
+    ar << this->keys_.size();  // data_size
+    ar << this->ts_;
+  }
+
+  template<class Archive>
+  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+    size_t data_size; ar >> data_size;
+    this->keys_ = mmap_struct::LazyVector<KeyType>(this->make_keys_path(), data_size);
+    this->values_ = mmap_struct::LazyVector<ValueType>(this->make_values_path(), data_size);
+    ar >> this->ts_;
+  }
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+// Same as `ColumnarMultiMapTS`, but keys are stored block-compressed
+// (`keys_blocks` and `keys_payload`). A lookup maps the TS search bound to
+// blocks and decodes only the block that contains the answer.
+template <class KeyType, class ValueType, class Index = ts::TrieSpline<KeyType>>
+class CompressedMultiMapTS {
+ public:
+  using element_type = pair<KeyType, ValueType>;
+
+  CompressedMultiMapTS(const vector<element_type>& elements, size_t max_error, fs::path root_path)
+      : keys_(ExtractKeys(elements), root_path / "keys"),
+        values_(elements.size(), root_path / "values", ValuesOf(elements)),
+        root_path_(root_path) {
+    assert(elements.size() > 0);
+
+    ts_ = BuildIndex<Index>(elements, max_error, root_path);
+
+    std::cout << "Compressed keys from " << elements.size() * sizeof(KeyType)
+              << " to " << keys_.GetSizeInByte() << " bytes" << std::endl;
+  }
+
+  // Returns the position of the first key not less than `key`, or `size()`.
+  size_t lower_bound(KeyType key) const {
+    ts::SearchBound bound = ts_.GetSearchBound(key);
+    return keys_.lower_bound(key, bound.begin, bound.end);
+  }
+
+  KeyType key_at(size_t pos) const { return keys_[pos]; }
+  ValueType value_at(size_t pos) const { return values_[pos]; }
+  size_t size() const { return keys_.size(); }
+
+  uint64_t sum_up(KeyType key) const {
+    const size_t begin = lower_bound(key);
+    size_t end = begin;
+    while (end < keys_.size() && keys_[end] == key) ++end;
+
+    uint64_t result = 0;
+    for (size_t pos = begin; pos < end; ++pos) result += values_[pos];
+    return result;
+  }
+
+  size_t GetSizeInByte() const { return ts_.GetSize(); }
+
+  /* Save-load */
+
+  // Save to file
+  void save_to_file() const {
+    fs::path meta_path = this->make_meta_path();
+    std::ofstream ofs(meta_path);
+    boost::archive::binary_oarchive oa(ofs);
+    oa << (*this);
+    std::cout << "Saved CompressedMultiMapTS to " << meta_path << std::endl;
+  }
+
+  // Load under path
+  CompressedMultiMapTS(fs::path root_path) : ts_(root_path), root_path_(root_path) {
+    fs::path meta_path = this->make_meta_path();
+    std::ifstream ifs(meta_path);
+    boost::archive::binary_iarchive ia(ifs);
+    ia >> (*this);
+    std::cout << "Loaded CompressedMultiMapTS from " << meta_path << std::endl;
+  }
+
+ private:
+  mmap_struct::BlockCompressedVector<KeyType> keys_;
+  mmap_struct::LazyVector<ValueType> values_;
+  Index ts_;
+  fs::path root_path_;
+
+  static vector<KeyType> ExtractKeys(const vector<element_type>& elements) {
+    vector<KeyType> keys(elements.size());
+    KeysOf(elements)(keys.data(), 0, keys.size());
+    return keys;
+  }
+
+  fs::path make_meta_path() const {
+    return this->root_path_ / "meta";
+  }
+
+  fs::path make_keys_path() const {
+    return this->root_path_ / "keys";
+  }
+
+  fs::path make_values_path() const {
+    return this->root_path_ / "values";
+  }
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void save(Archive & ar, const unsigned int version __attribute__((unused))) const {
+    ar << this->keys_.size();  // data_size
+    ar << this->ts_;
+  }
+
+  template<class Archive>
+  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+    size_t data_size; ar >> data_size;
+    this->keys_ = mmap_struct::BlockCompressedVector<KeyType>(this->make_keys_path(), data_size);
+    this->values_ = mmap_struct::LazyVector<ValueType>(this->make_values_path(), data_size);
+    ar >> this->ts_;
+  }
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+// Multimap for heavily duplicated keys: the TS is built over the distinct
+// keys only (`keys`), and each distinct key maps to its run of rows
+// (`run_begins`, with one extra entry for the end). Values are kept in row
+// order (`values`), and `sums` holds the prefix sums of the values by run.
+// After the model lookup, `equal_range`, `count` and `sum_up` take O(1),
+// however long the run.
+template <class KeyType, class ValueType, class Index = ts::TrieSpline<KeyType>>
+class DistinctMultiMapTS {
+ public:
+  using element_type = pair<KeyType, ValueType>;
+
+  DistinctMultiMapTS(const vector<element_type>& elements, size_t max_error, fs::path root_path)
+      : values_(elements.size(), root_path / "values", ValuesOf(elements)),
+        root_path_(root_path) {
+    assert(elements.size() > 0);
+
+    // Collapse the runs of equal keys.
+    vector<KeyType> keys;
+    vector<uint64_t> run_begins;
+    vector<uint64_t> sums = {0};
+    for (size_t pos = 0; pos < elements.size(); ++pos) {
+      if (pos == 0 || elements[pos].first != elements[pos - 1].first) {
+        keys.push_back(elements[pos].first);
+        run_begins.push_back(pos);
+        sums.push_back(sums.back());
+      }
+      sums.back() += elements[pos].second;
+    }
+    run_begins.push_back(elements.size());
+    keys_ = mmap_struct::LazyVector<KeyType>(keys, this->make_keys_path());
+    run_begins_ = mmap_struct::LazyVector<uint64_t>(run_begins, this->make_run_begins_path());
+    sums_ = mmap_struct::LazyVector<uint64_t>(sums, this->make_sums_path());
+
+    // Build TS over the distinct keys.
+    ts_ = BuildIndex<Index>(keys.size(), [&keys](size_t idx) { return keys[idx]; },
+                            ts::ErrorProfile<KeyType>(max_error), root_path);
+  }
+
+  // Returns the position of the first row whose key is not less than `key`,
+  // or `size()`.
+  size_t lower_bound(KeyType key) const {
+    return run_begins_[lower_bound_run(key)];
+  }
+
+  // Returns the positions [begin, end) of the rows with key `key`.
+  std::pair<size_t, size_t> equal_range(KeyType key) const {
+    const size_t run = lower_bound_run(key);
+    const size_t begin = run_begins_[run];
+    if (run == keys_.size() || keys_[run] != key) return {begin, begin};
+    return {begin, run_begins_[run + 1]};
+  }
+
+  size_t count(KeyType key) const {
+    const auto range = equal_range(key);
+    return range.second - range.first;
+  }
+
+  uint64_t sum_up(KeyType key) const {
+    const size_t run = lower_bound_run(key);
+    if (run == keys_.size() || keys_[run] != key) return 0;
+    return sums_[run + 1] - sums_[run];
+  }
+
+  ValueType value_at(size_t pos) const { return values_[pos]; }
+  size_t size() const { return values_.size(); }
+  size_t num_distinct_keys() const { return keys_.size(); }
+
+  size_t GetSizeInByte() const { return ts_.GetSize(); }
+
+  /* Save-load */
+
+  // Save to file
+  void save_to_file() const {
+    fs::path meta_path = this->make_meta_path();
+    std::ofstream ofs(meta_path);
+    boost::archive::binary_oarchive oa(ofs);
+    oa << (*this);
+    std::cout << "Saved DistinctMultiMapTS to " << meta_path << std::endl;
+  }
+
+  // Load under path
+  DistinctMultiMapTS(fs::path root_path) : ts_(root_path), root_path_(root_path) {
+    fs::path meta_path = this->make_meta_path();
+    std::ifstream ifs(meta_path);
+    boost::archive::binary_iarchive ia(ifs);
+    ia >> (*this);
+    std::cout << "Loaded DistinctMultiMapTS from " << meta_path << std::endl;
+  }
+
+ private:
+  mmap_struct::LazyVector<KeyType> keys_;
+  mmap_struct::LazyVector<uint64_t> run_begins_;
+  mmap_struct::LazyVector<uint64_t> sums_;
+  mmap_struct::LazyVector<ValueType> values_;
+  Index ts_;
+  fs::path root_path_;
+
+  // Returns the index of the first distinct key not less than `key`, or
+  // `num_distinct_keys()`.
+  size_t lower_bound_run(KeyType key) const {
+    ts::SearchBound bound = ts_.GetSearchBound(key);
+    auto first = keys_.data() + bound.begin;
+    auto last = keys_.data() + bound.end;
+    return ::lower_bound(first, last, key) - keys_.data();
+  }
+
+  fs::path make_meta_path() const {
+    return this->root_path_ / "meta";
+  }
+
+  fs::path make_keys_path() const {
+    return this->root_path_ / "keys";
+  }
+
+  fs::path make_run_begins_path() const {
+    return this->root_path_ / "run_begins";
+  }
+
+  fs::path make_sums_path() const {
+    return this->root_path_ / "sums";
+  }
+
+  fs::path make_values_path() const {
+    return this->root_path_ / "values";
+  }
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void save(Archive & ar, const unsigned int version __attribute__((unused))) const {
+    ar << this->keys_.size();  // num_distinct_keys
+    ar << this->values_.size();  // data_size
+    ar << this->ts_;
+  }
+
+  template<class Archive>
+  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+    size_t num_distinct_keys; ar >> num_distinct_keys;
+    size_t data_size; ar >> data_size;
+    this->keys_ = mmap_struct::LazyVector<KeyType>(this->make_keys_path(), num_distinct_keys);
+    this->run_begins_ = mmap_struct::LazyVector<uint64_t>(this->make_run_begins_path(), num_distinct_keys + 1);
+    this->sums_ = mmap_struct::LazyVector<uint64_t>(this->make_sums_path(), num_distinct_keys + 1);
+    this->values_ = mmap_struct::LazyVector<ValueType>(this->make_values_path(), data_size);
+    ar >> this->ts_;
+  }
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+// Multimap over variable-length byte string keys: a `ts::StringTrieSpline`
+// over the keys, which are front-coded in a `ts::StringStore` (`strings`),
+// and the values in key order (`values`). The last-mile search decodes only
+// the keys inside the search bound.
+template <class ValueType>
+class StringMultiMapTS {
+ public:
+  using element_type = pair<std::string, ValueType>;
+
+  StringMultiMapTS(const vector<element_type>& elements, size_t max_error, fs::path root_path)
+      : keys_(elements.size(), [&elements](size_t idx) { return std::string_view(elements[idx].first); },
+              root_path),
+        values_(elements.size(), root_path / "values", ValuesOf(elements)),
+        root_path_(root_path) {
+    assert(elements.size() > 0);
+
+    ts::StringBuilder tsb(max_error, root_path);
+    for (const auto& iter : elements) tsb.AddKey(iter.first);
+    ts_ = tsb.Finalize();
+  }
+
+  // Returns the position of the first key not less than `key`, or `size()`.
+  size_t lower_bound(std::string_view key) const {
+    return keys_.LowerBound(key, ts_.GetSearchBound(key));
+  }
+
+  std::string key_at(size_t pos) const { return keys_.Get(pos); }
+  ValueType value_at(size_t pos) const { return values_[pos]; }
+  size_t size() const { return values_.size(); }
+
+  uint64_t sum_up(std::string_view key) const {
+    const size_t begin = lower_bound(key);
+    uint64_t result = 0;
+    for (size_t pos = begin; pos < size() && keys_.Get(pos) == key; ++pos) result += values_[pos];
+    return result;
+  }
+
+  size_t GetSizeInByte() const { return ts_.GetSize(); }
+
+  /* Save-load */
+
+  // Save to file
+  void save_to_file() const {
+    fs::path meta_path = this->make_meta_path();
+    std::ofstream ofs(meta_path);
+    boost::archive::binary_oarchive oa(ofs);
+    oa << (*this);
+    std::cout << "Saved StringMultiMapTS to " << meta_path << std::endl;
+  }
+
+  // Load under path
+  StringMultiMapTS(fs::path root_path) : keys_(root_path), ts_(root_path), root_path_(root_path) {
+    fs::path meta_path = this->make_meta_path();
+    std::ifstream ifs(meta_path);
+    boost::archive::binary_iarchive ia(ifs);
+    ia >> (*this);
+    std::cout << "Loaded StringMultiMapTS from " << meta_path << std::endl;
+  }
+
+ private:
+  ts::StringStore keys_;
+  mmap_struct::LazyVector<ValueType> values_;
+  ts::StringTrieSpline ts_;
+  fs::path root_path_;
+
+  fs::path make_meta_path() const {
+    return this->root_path_ / "meta";
+  }
+
+  fs::path make_values_path() const {
+    return this->root_path_ / "values";
+  }
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void save(Archive & ar, const unsigned int version __attribute__((unused))) const {
+    ar << this->values_.size();  // data_size
+    ar << this->keys_;
+    ar << this->ts_;
+  }
+
+  template<class Archive>
+  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+    size_t data_size; ar >> data_size;
+    this->values_ = mmap_struct::LazyVector<ValueType>(this->make_values_path(), data_size);
+    ar >> this->keys_;
+    ar >> this->ts_;
   }
   BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
@@ -393,7 +1009,8 @@ struct Lookup {
   uint64_t value;
 };
 
-template <class KeyType>
+// With `Model` = `rs::RadixSplineView`, lookups go through the bulk format.
+template <class KeyType, class Model = rs::RadixSpline<KeyType>>
 void RunRS(const string& data_file, const string lookup_file) {
   // Load data
   vector<KeyType> keys = util::load_data<KeyType>(data_file);
@@ -408,8 +1025,8 @@ void RunRS(const string& data_file, const string lookup_file) {
 
     // Build RS
     auto build_begin = chrono::high_resolution_clock::now();
-    NonOwningMultiMapRS<KeyType, uint64_t> map(elements, tuning.first,
-                                             tuning.second);
+    NonOwningMultiMapRS<KeyType, uint64_t, Model> map(elements, tuning.first,
+                                                    tuning.second);
     auto build_end = chrono::high_resolution_clock::now();
     uint64_t build_ns =
         chrono::duration_cast<chrono::nanoseconds>(build_end - build_begin)
@@ -429,7 +1046,8 @@ void RunRS(const string& data_file, const string lookup_file) {
         chrono::duration_cast<chrono::nanoseconds>(lookup_end - lookup_begin)
             .count();
 
-    cout << "RS," << data_file << "," << tuning.second << "," << tuning.first << ","
+    const bool view = std::is_same<Model, rs::RadixSplineView<KeyType>>::value;
+    cout << (view ? "RSView," : "RS,") << data_file << "," << tuning.second << "," << tuning.first << ","
        << static_cast<double>(map.GetSizeInByte()) / 1000 / 1000 << ","
        << static_cast<double>(build_ns) / 1000 / 1000 / 1000 << ","
        << lookup_ns / lookups.size() << endl;
@@ -524,6 +1142,20 @@ void CustomRunTS(const string& data_file, const string lookup_file, const uint32
 
 }  // namespace util
 
+namespace boost {
+namespace serialization {
+
+// Version 1: the Bloom filter. Plexes saved before it load without one.
+template <class KeyType, class ValueType, class Index, class Record>
+struct version<util::NonOwningMultiMapTS<KeyType, ValueType, Index, Record>> {
+  typedef mpl::integral_c_tag tag;
+  typedef mpl::int_<1> type;
+  BOOST_STATIC_CONSTANT(int, value = 1);
+};
+
+}  // namespace serialization
+}  // namespace boost
+
 
 std::map<std::string, std::string> parse_flags(int argc, char** argv) {
   std::map<std::string, std::string> flags;
@@ -592,7 +1224,7 @@ std::vector<std::string> get_comma_separated(
 }
 
 template <class T>
-bool load_binary_data(T data[], int length, const std::string& file_path) {
+bool load_binary_data(T data[], size_t length, const std::string& file_path) {
   std::ifstream is(file_path.c_str(), std::ios::binary | std::ios::in);
   if (!is.is_open()) {
     return false;
@@ -603,12 +1235,12 @@ bool load_binary_data(T data[], int length, const std::string& file_path) {
 }
 
 template <class T>
-bool load_text_data(T array[], int length, const std::string& file_path) {
+bool load_text_data(T array[], size_t length, const std::string& file_path) {
   std::ifstream is(file_path.c_str());
   if (!is.is_open()) {
     return false;
   }
-  int i = 0;
+  size_t i = 0;
   std::string str;
   while (std::getline(is, str) && i < length) {
     std::istringstream ss(str);
@@ -620,7 +1252,7 @@ bool load_text_data(T array[], int length, const std::string& file_path) {
 }
 
 template <class T>
-bool load_sosd_data(T data[], int length, const std::string& file_path) {
+bool load_sosd_data(T data[], size_t length, const std::string& file_path) {
   std::ifstream is(file_path.c_str(), std::ios::binary | std::ios::in);
   if (!is.is_open()) {
     return false;
@@ -634,3 +1266,22 @@ bool load_sosd_data(T data[], int length, const std::string& file_path) {
   is.close();
   return true;
 }
+
+// Returns the keys of a keyset file, one "<key> <expected answer>" per line
+// as issued by kv_benchmark.
+template <class T>
+std::vector<T> load_keyset_keys(const std::string& file_path) {
+  std::vector<T> keys;
+  std::ifstream is(file_path.c_str());
+  if (!is.is_open()) {
+    std::cerr << "unable to open " << file_path << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::string str;
+  while (std::getline(is, str)) {
+    std::istringstream ss(str);
+    T key;
+    if (ss >> key) keys.push_back(key);
+  }
+  return keys;
+}
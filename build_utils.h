@@ -0,0 +1,478 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench_utils.h"
+#include "include/rs/radix_sort.h"
+
+namespace util {
+
+/* Streaming, external-memory build of a `NonOwningMultiMapTS` */
+
+// Reads keys in chunks from a binary, text or SOSD keys file.
+template <class KeyType>
+class KeyReader {
+ public:
+  KeyReader(const std::string& file_path, const std::string& file_type, size_t max_num_keys)
+      : file_path_(file_path), file_type_(file_type), max_num_keys_(max_num_keys) {
+    Rewind();
+  }
+
+  // Reads up to `capacity` keys into `out` and returns the number read.
+  size_t Next(KeyType* out, size_t capacity) {
+    capacity = std::min(capacity, max_num_keys_ - num_read_);
+    size_t count = 0;
+    if (file_type_ == "text") {
+      std::string line;
+      while (count < capacity && std::getline(in_, line)) {
+        out[count++] = static_cast<KeyType>(std::strtoull(line.c_str(), nullptr, 10));
+      }
+    } else {
+      in_.read(reinterpret_cast<char*>(out), std::streamsize(capacity * sizeof(KeyType)));
+      count = in_.gcount() / sizeof(KeyType);
+    }
+    num_read_ += count;
+    return count;
+  }
+
+  // Restarts reading from the first key.
+  void Rewind() {
+    in_.close();
+    in_.clear();
+    if (file_type_ == "text") {
+      in_.open(file_path_);
+    } else {
+      in_.open(file_path_, std::ios::binary | std::ios::in);
+    }
+    if (!in_.is_open()) {
+      std::cerr << "unable to open " << file_path_ << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (file_type_ == "sosd") {
+      // Skip the first 8 bytes of SOSD blob (number of key).
+      in_.seekg(sizeof(uint64_t));
+    }
+    num_read_ = 0;
+  }
+
+ private:
+  std::string file_path_;
+  std::string file_type_;
+  size_t max_num_keys_;
+  size_t num_read_;
+  std::ifstream in_;
+};
+
+// Appends trivially copyable elements to a file through a large buffer, and
+// syncs the file on `Close`. With `num_kept` > 0, an existing file is cut to
+// its first `num_kept` elements and appended to. Like `mmap_struct::WriteFile`,
+// it follows `options`: full buffers are written by several threads with
+// `pwrite`, and with `direct_io` only whole aligned blocks are written, the
+// tail being padded on `Sync` and cut off again.
+template <class T>
+class BufferedFileWriter {
+ public:
+  BufferedFileWriter(fs::path filepath, size_t buffer_bytes, size_t num_kept = 0,
+                     const mmap_struct::WriteOptions& options = mmap_struct::DefaultWriteOptions())
+      : filepath_(filepath),
+        num_threads_(ts::ResolveNumThreads(options.num_threads)),
+        direct_io_(false),
+        offset_(0),
+        used_(0) {
+    const int flags = O_RDWR | O_CREAT | (num_kept > 0 ? 0 : O_TRUNC);
+    fd_ = -1;
+    if (options.direct_io) {
+      fd_ = open(filepath.c_str(), flags | O_DIRECT, 0644);
+      if (fd_ < 0) {
+        int errnum = errno;
+        std::cerr << "Cannot use O_DIRECT for " << filepath << " (" << strerror(errnum)
+                  << "), writing through the page cache" << std::endl;
+      }
+      direct_io_ = fd_ >= 0;
+    }
+    if (fd_ < 0) fd_ = open(filepath.c_str(), flags, 0644);
+    if (fd_ < 0) {
+      int errnum = errno;
+      std::cerr << "Error write-opening " << filepath << ": " << strerror(errnum) << std::endl;
+      exit(1);
+    }
+
+    // Room for the buffer and a block of tail, so an element always fits after
+    // a flush.
+    capacity_ = (std::max(buffer_bytes, sizeof(T)) + Alignment - 1) / Alignment * Alignment + Alignment;
+    void* buffer;
+    if (posix_memalign(&buffer, Alignment, capacity_) != 0) {
+      std::cerr << "Error allocating write buffer" << std::endl;
+      exit(1);
+    }
+    buffer_ = reinterpret_cast<char*>(buffer);
+
+    if (num_kept > 0) {
+      // Continue from the block holding the end of the kept elements.
+      const size_t kept_bytes = num_kept * sizeof(T);
+      offset_ = direct_io_ ? kept_bytes / Alignment * Alignment : kept_bytes;
+      used_ = kept_bytes - offset_;
+      if (ftruncate(fd_, kept_bytes) != 0 ||
+          (used_ > 0 && pread(fd_, buffer_, Alignment, offset_) < ssize_t(used_))) {
+        int errnum = errno;
+        std::cerr << "Error resuming " << filepath << ": " << strerror(errnum) << std::endl;
+        exit(1);
+      }
+    }
+  }
+
+  BufferedFileWriter(const BufferedFileWriter& other) = delete;
+  BufferedFileWriter& operator=(const BufferedFileWriter& other) = delete;
+
+  ~BufferedFileWriter() {
+    Close();
+    free(buffer_);
+  }
+
+  void Append(const T& element) {
+    if (used_ + sizeof(T) > capacity_) Flush();
+    memcpy(buffer_ + used_, &element, sizeof(T));
+    used_ += sizeof(T);
+  }
+
+  void Append(const T* elements, size_t count) {
+    for (size_t idx = 0; idx < count; ++idx) Append(elements[idx]);
+  }
+
+  // Writes the buffer, but for a partial block with `direct_io`.
+  void Flush() {
+    const size_t bytes = direct_io_ ? used_ / Alignment * Alignment : used_;
+    Write(bytes);
+    memmove(buffer_, buffer_ + bytes, used_ - bytes);
+    offset_ += bytes;
+    used_ -= bytes;
+  }
+
+  // Makes everything appended so far durable.
+  void Sync() {
+    Flush();
+    if (used_ > 0) {
+      // Write the partial block padded, and cut the padding off.
+      const size_t padded_bytes = (used_ + Alignment - 1) / Alignment * Alignment;
+      memset(buffer_ + used_, 0, padded_bytes - used_);
+      Write(padded_bytes);
+      if (ftruncate(fd_, offset_ + used_) != 0) {
+        int errnum = errno;
+        std::cerr << "Error truncating " << filepath_ << ": " << strerror(errnum) << std::endl;
+        exit(1);
+      }
+    }
+    fdatasync(fd_);
+  }
+
+  void Close() {
+    if (fd_ == -1) return;
+    Sync();
+    close(fd_);
+    fd_ = -1;
+  }
+
+  size_t size() const { return (offset_ + used_) / sizeof(T); }
+
+ private:
+  static constexpr size_t Alignment = 4096;  // for O_DIRECT
+  static constexpr size_t MinThreadBytes = 4 << 20;
+
+  // Writes the first `bytes` of the buffer at `offset_`, split over threads at
+  // block boundaries.
+  void Write(size_t bytes) {
+    const size_t num_blocks = (bytes + Alignment - 1) / Alignment;
+    const size_t num_threads = ts::NumThreadsFor(num_threads_, bytes, MinThreadBytes);
+    ts::ParallelFor(num_threads, num_blocks, [&](size_t /*t*/, size_t first_block, size_t last_block) {
+      size_t begin = first_block * Alignment;
+      const size_t end = std::min(bytes, last_block * Alignment);
+      while (begin < end) {
+        ssize_t written = pwrite(fd_, buffer_ + begin, end - begin, offset_ + begin);
+        if (written < 0) {
+          int errnum = errno;
+          std::cerr << "Error writing " << filepath_ << ": " << strerror(errnum) << std::endl;
+          exit(1);
+        }
+        begin += written;
+      }
+    });
+  }
+
+  fs::path filepath_;
+  size_t num_threads_;
+  bool direct_io_;
+  int fd_;
+  char* buffer_;
+  size_t capacity_;
+  size_t offset_;  // file offset of the buffer
+  size_t used_;    // bytes in the buffer
+};
+
+// Reads a sorted run written by `BufferedFileWriter` through a buffer.
+template <class T>
+class RunReader {
+ public:
+  RunReader(fs::path filepath, size_t buffer_elements)
+      : in_(filepath, std::ios::binary | std::ios::in), pos_(0) {
+    if (!in_.is_open()) {
+      std::cerr << "unable to open " << filepath << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    buffer_.resize(std::max<size_t>(1, buffer_elements));
+    Refill();
+  }
+
+  bool Valid() const { return pos_ < buffer_.size(); }
+  const T& Current() const { return buffer_[pos_]; }
+
+  void Advance() {
+    if (++pos_ == buffer_.size()) Refill();
+  }
+
+ private:
+  void Refill() {
+    buffer_.resize(buffer_.capacity());
+    in_.read(reinterpret_cast<char*>(buffer_.data()), std::streamsize(buffer_.size() * sizeof(T)));
+    buffer_.resize(in_.gcount() / sizeof(T));
+    pos_ = 0;
+  }
+
+  std::ifstream in_;
+  std::vector<T> buffer_;
+  size_t pos_;
+};
+
+// Builds a `NonOwningMultiMapTS` under `db_path` from a keys file, whose
+// `i`th key gets value `i`. Keys are streamed from the file; the data file is
+// written and `ts::Builder` is fed in the same pass. Input and merge buffers
+// stay within `memory_budget` bytes (the spline itself is not counted).
+// Unsorted input goes through an external merge sort, with sorted runs under
+// `db_path/runs`.
+//
+// With `checkpoint_interval` > 0, the data file is synced and the builder
+// state is saved to `db_path/checkpoint` every `checkpoint_interval` keys.
+// With `resume`, a build continues from that checkpoint: the sorted stream is
+// deterministic, so its first `GetNumKeys()` elements are skipped, and sorted
+// runs that were completely written are reused. A checkpoint saved for
+// another keys file, number of keys, key range or `max_error` fails the build.
+template <class KeyType, class ValueType>
+class StreamingBuilderTS {
+ public:
+  using element_type = std::pair<KeyType, ValueType>;
+  using Map = NonOwningMultiMapTS<KeyType, ValueType>;
+
+  StreamingBuilderTS(const std::string& keys_file, const std::string& keys_file_type,
+                     size_t num_keys, size_t max_error, fs::path db_path,
+                     size_t memory_budget, size_t checkpoint_interval = 0, bool resume = false)
+      : reader_(keys_file, keys_file_type, num_keys),
+        keys_file_(keys_file),
+        keys_file_type_(keys_file_type),
+        max_error_(max_error),
+        db_path_(db_path),
+        chunk_size_(std::max<size_t>(1, memory_budget / sizeof(element_type))),
+        checkpoint_interval_(checkpoint_interval),
+        resume_(resume) {}
+
+  // Runs the build and saves the map under `db_path`.
+  void Build() {
+    // First pass: count keys, find the key range and check sortedness.
+    Scan();
+    std::cout << "Scanned " << num_keys_ << " keys, "
+              << (is_sorted_ ? "sorted" : "unsorted") << std::endl;
+    assert(num_keys_ > 0);
+
+    fs::create_directories(db_path_);
+    const bool resume = resume_ && fs::exists(CheckpointPath());
+    if (resume_ && !resume) {
+      std::cout << "No checkpoint at " << CheckpointPath() << ", building from scratch" << std::endl;
+    }
+    ts::Builder<KeyType> tsb = resume
+        ? ts::Builder<KeyType>::LoadCheckpoint(CheckpointPath(), min_key_, max_key_,
+                                               ts::ErrorProfile<KeyType>(max_error_), InputIdentity(),
+                                               db_path_)
+        : ts::Builder<KeyType>(min_key_, max_key_, max_error_, db_path_);
+    const size_t num_done = tsb.GetNumKeys();
+    BufferedFileWriter<element_type> data(db_path_ / "data", WriterBufferBytes(), num_done);
+    size_t position = 0;
+    const auto add = [&](const element_type& element) {
+      // Skip what the checkpoint already covers.
+      if (position++ < num_done) return;
+      data.Append(element);
+      tsb.AddKey(element.first);
+      if (checkpoint_interval_ > 0 && tsb.GetNumKeys() % checkpoint_interval_ == 0) {
+        data.Sync();
+        tsb.SaveCheckpoint(CheckpointPath(), InputIdentity());
+      }
+    };
+
+    if (is_sorted_) {
+      StreamSorted(add);
+    } else {
+      MergeRuns(resume ? FindRuns() : WriteRuns(), add);
+    }
+    data.Close();
+
+    Map map(db_path_, num_keys_, tsb.Finalize());
+    map.save_to_file();
+    fs::remove(CheckpointPath());
+  }
+
+  KeyType min_key() const { return min_key_; }
+
+ private:
+  // One eighth of the budget goes to the output writer, the rest to the
+  // input: the keys of the current chunk and their sorted (key, value) pairs,
+  // or the buffers of the merged runs.
+  size_t InputElements() const {
+    return std::max<size_t>(1, chunk_size_ - chunk_size_ / 8);
+  }
+
+  size_t KeysPerChunk() const {
+    return std::max<size_t>(1, InputElements() * sizeof(element_type) /
+                                   (sizeof(KeyType) + sizeof(element_type)));
+  }
+
+  size_t WriterBufferBytes() const {
+    return std::max<size_t>(sizeof(element_type), chunk_size_ / 8 * sizeof(element_type));
+  }
+
+  void Scan() {
+    std::vector<KeyType> chunk(KeysPerChunk());
+    reader_.Rewind();
+    num_keys_ = 0;
+    is_sorted_ = true;
+    for (size_t count; (count = reader_.Next(chunk.data(), chunk.size())) > 0;) {
+      for (size_t idx = 0; idx < count; ++idx) {
+        const KeyType key = chunk[idx];
+        if (num_keys_ == 0) {
+          min_key_ = max_key_ = key;
+        } else {
+          is_sorted_ &= (key >= prev_key_);
+          min_key_ = std::min(min_key_, key);
+          max_key_ = std::max(max_key_, key);
+        }
+        prev_key_ = key;
+        ++num_keys_;
+      }
+    }
+  }
+
+  template <class Add>
+  void StreamSorted(Add add) {
+    std::vector<KeyType> chunk(KeysPerChunk());
+    reader_.Rewind();
+    ValueType value = 0;
+    for (size_t count; (count = reader_.Next(chunk.data(), chunk.size())) > 0;) {
+      for (size_t idx = 0; idx < count; ++idx) add({chunk[idx], value++});
+    }
+  }
+
+  // Writes sorted runs of at most `KeysPerChunk()` elements.
+  std::vector<fs::path> WriteRuns() {
+    fs::create_directories(RunsPath());
+    fs::remove(RunsPath() / "complete");
+    std::vector<fs::path> runs;
+    std::vector<KeyType> chunk(KeysPerChunk());
+    std::vector<element_type> elements;
+    elements.reserve(chunk.size());
+    reader_.Rewind();
+    ValueType value = 0;
+    for (size_t count; (count = reader_.Next(chunk.data(), chunk.size())) > 0;) {
+      elements.clear();
+      for (size_t idx = 0; idx < count; ++idx) elements.push_back({chunk[idx], value++});
+      rs::RadixSort(elements);
+
+      runs.push_back(RunsPath() / ("run_" + std::to_string(runs.size())));
+      BufferedFileWriter<element_type> run(runs.back(), WriterBufferBytes());
+      run.Append(elements.data(), elements.size());
+    }
+    std::cout << "Wrote " << runs.size() << " sorted runs to " << RunsPath() << std::endl;
+
+    // Mark the runs as complete, for this input.
+    std::ofstream(RunsPath() / "complete") << runs.size() << "\n" << InputIdentity() << std::endl;
+    return runs;
+  }
+
+  // Returns the runs of an earlier `WriteRuns`, or writes them if they are
+  // incomplete or of another input.
+  std::vector<fs::path> FindRuns() {
+    std::ifstream complete(RunsPath() / "complete");
+    size_t num_runs;
+    std::string input;
+    if (!(complete >> num_runs) || !std::getline(complete >> std::ws, input)) return WriteRuns();
+    if (input != InputIdentity()) {
+      std::cout << "Sorted runs in " << RunsPath() << " are of " << input
+                << ", rewriting them" << std::endl;
+      return WriteRuns();
+    }
+    std::vector<fs::path> runs;
+    for (size_t idx = 0; idx < num_runs; ++idx) {
+      runs.push_back(RunsPath() / ("run_" + std::to_string(idx)));
+    }
+    std::cout << "Reusing " << runs.size() << " sorted runs in " << RunsPath() << std::endl;
+    return runs;
+  }
+
+  // Merges the sorted `runs`, ties broken by value, and removes them.
+  template <class Add>
+  void MergeRuns(const std::vector<fs::path>& runs, Add add) {
+    const size_t buffer_elements = InputElements() / runs.size();
+    std::vector<std::unique_ptr<RunReader<element_type>>> readers;
+    for (const auto& run : runs) {
+      readers.push_back(std::make_unique<RunReader<element_type>>(run, buffer_elements));
+    }
+
+    using Head = std::pair<element_type, size_t>;  // (element, run)
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (size_t idx = 0; idx < readers.size(); ++idx) {
+      if (readers[idx]->Valid()) heads.push({readers[idx]->Current(), idx});
+    }
+    while (!heads.empty()) {
+      const auto [element, idx] = heads.top();
+      heads.pop();
+      add(element);
+      readers[idx]->Advance();
+      if (readers[idx]->Valid()) heads.push({readers[idx]->Current(), idx});
+    }
+
+    readers.clear();
+    fs::remove_all(RunsPath());
+  }
+
+  fs::path RunsPath() const { return db_path_ / "runs"; }
+  fs::path CheckpointPath() const { return db_path_ / "checkpoint"; }
+
+  // Identifies the input in checkpoints: the keys file, its size, and the
+  // number of keys read from it.
+  std::string InputIdentity() const {
+    std::ostringstream identity;
+    identity << fs::absolute(keys_file_).string() << " (" << keys_file_type_ << ", "
+             << fs::file_size(keys_file_) << " bytes, " << num_keys_ << " keys)";
+    return identity.str();
+  }
+
+  KeyReader<KeyType> reader_;
+  std::string keys_file_;
+  std::string keys_file_type_;
+  size_t max_error_;
+  fs::path db_path_;
+  size_t chunk_size_;
+  size_t checkpoint_interval_;
+  bool resume_;
+
+  size_t num_keys_;
+  bool is_sorted_;
+  KeyType min_key_;
+  KeyType max_key_;
+  KeyType prev_key_;
+};
+
+}  // namespace util
@@ -2,9 +2,11 @@
 
 #include <iterator>
 #include <limits>
+#include <type_traits>
 #include <vector>
 
 #include "builder.h"
+#include "radix_sort.h"
 #include "radix_spline.h"
 
 namespace rs {
@@ -68,10 +70,14 @@ MultiMap<KeyType, ValueType>::MultiMap(BidirIt first, BidirIt last,
 
   // Sort if necessary.
   if (!is_sorted) {
-    std::sort(data_.begin(), data_.end(),
-              [](const value_type& lhs, const value_type& rhs) {
-                return lhs.first < rhs.first;
-              });
+    if constexpr (std::is_unsigned<KeyType>::value) {
+      RadixSort(data_);
+    } else {
+      std::sort(data_.begin(), data_.end(),
+                [](const value_type& lhs, const value_type& rhs) {
+                  return lhs.first < rhs.first;
+                });
+    }
   }
 
   // Create spline builder.
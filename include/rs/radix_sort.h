@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../ts/parallel.h"
+
+namespace rs {
+
+// Stable, parallel sort of (key, payload) pairs by key, for unsigned integer
+// keys. Sorted input is detected and left untouched, input made of a few
+// sorted runs is merged, and anything else goes through an LSD radix sort
+// that skips digits shared by all keys.
+template <class KeyType, class ValueType>
+class RadixSorter {
+  static_assert(std::is_integral<KeyType>::value && std::is_unsigned<KeyType>::value,
+                "RadixSorter requires unsigned integer keys");
+
+ public:
+  using value_type = std::pair<KeyType, ValueType>;
+
+  // Uses `num_threads` threads, or one per hardware thread if 0.
+  RadixSorter(size_t num_threads = 0)
+      : num_threads_(ts::ResolveNumThreads(num_threads)) {}
+
+  void Sort(std::vector<value_type>& data) const {
+    const size_t size = data.size();
+    if (size < MinRadixSize) {
+      std::stable_sort(data.begin(), data.end(), KeyLess);
+      return;
+    }
+
+    // Already or nearly sorted: merge the sorted runs.
+    const std::vector<size_t> runs = FindRuns(data);
+    if (runs.size() == 2) return;
+    if (runs.size() - 1 <= MaxNaturalRuns) {
+      MergeRuns(data, runs);
+      return;
+    }
+
+    RadixSort(data);
+  }
+
+ private:
+  static constexpr size_t DigitBits = 11;
+  static constexpr size_t NumBuckets = size_t(1) << DigitBits;
+  static constexpr size_t NumDigits = (sizeof(KeyType) * 8 + DigitBits - 1) / DigitBits;
+  // Below this size the sort runs on one thread with `std::stable_sort`.
+  static constexpr size_t MinRadixSize = size_t(1) << 12;
+  // Minimum number of elements per thread.
+  static constexpr size_t MinThreadSize = size_t(1) << 16;
+  // Input with at most this many sorted runs is merged instead of radix-sorted.
+  static constexpr size_t MaxNaturalRuns = 16;
+
+  using Histogram = std::array<size_t, NumBuckets>;
+
+  static bool KeyLess(const value_type& lhs, const value_type& rhs) {
+    return lhs.first < rhs.first;
+  }
+
+  static size_t Digit(KeyType key, size_t digit) {
+    return (key >> (digit * DigitBits)) & (NumBuckets - 1);
+  }
+
+  size_t NumThreads(size_t size) const {
+    return ts::NumThreadsFor(num_threads_, size, MinThreadSize);
+  }
+
+  // Returns the boundaries of the maximal sorted runs, including 0 and the
+  // size. Gives up early, with more than `MaxNaturalRuns` runs.
+  std::vector<size_t> FindRuns(const std::vector<value_type>& data) const {
+    const size_t num_threads = NumThreads(data.size());
+    std::vector<std::vector<size_t>> descents(num_threads);
+    ts::ParallelFor(num_threads, data.size(), [&](size_t t, size_t begin, size_t end) {
+      for (size_t idx = std::max<size_t>(begin, 1); idx < end; ++idx) {
+        if (data[idx].first < data[idx - 1].first) {
+          descents[t].push_back(idx);
+          if (descents[t].size() > MaxNaturalRuns) return;
+        }
+      }
+    });
+
+    std::vector<size_t> runs = {0};
+    for (const auto& thread_descents : descents) {
+      runs.insert(runs.end(), thread_descents.begin(), thread_descents.end());
+    }
+    runs.push_back(data.size());
+    return runs;
+  }
+
+  // Merges adjacent pairs of runs until one is left.
+  void MergeRuns(std::vector<value_type>& data, std::vector<size_t> runs) const {
+    while (runs.size() > 2) {
+      const size_t num_merges = (runs.size() - 1) / 2;
+      std::vector<std::thread> threads;
+      for (size_t idx = 0; idx < num_merges; ++idx) {
+        const auto first = data.begin() + runs[2 * idx];
+        const auto middle = data.begin() + runs[2 * idx + 1];
+        const auto last = data.begin() + runs[2 * idx + 2];
+        threads.emplace_back([first, middle, last]() {
+          std::inplace_merge(first, middle, last, KeyLess);
+        });
+      }
+      for (auto& thread : threads) thread.join();
+
+      std::vector<size_t> merged;
+      for (size_t idx = 0; idx < runs.size(); idx += 2) merged.push_back(runs[idx]);
+      if (merged.back() != runs.back()) merged.push_back(runs.back());
+      runs = std::move(merged);
+    }
+  }
+
+  // LSD radix sort, one pass per digit that differs across keys, ping-ponging
+  // between `data` and a buffer of the same size.
+  void RadixSort(std::vector<value_type>& data) const {
+    const size_t size = data.size();
+    const size_t num_threads = NumThreads(size);
+
+    // Find the digits that actually vary, with one pass over the keys.
+    std::vector<std::array<Histogram, NumDigits>> digit_counts(num_threads);
+    ts::ParallelFor(num_threads, size, [&](size_t t, size_t begin, size_t end) {
+      auto& counts = digit_counts[t];
+      for (auto& histogram : counts) histogram.fill(0);
+      for (size_t idx = begin; idx < end; ++idx) {
+        for (size_t digit = 0; digit < NumDigits; ++digit) {
+          ++counts[digit][Digit(data[idx].first, digit)];
+        }
+      }
+    });
+    std::vector<size_t> digits;
+    for (size_t digit = 0; digit < NumDigits; ++digit) {
+      const size_t bucket = Digit(data[0].first, digit);
+      size_t count = 0;
+      for (const auto& counts : digit_counts) count += counts[digit][bucket];
+      if (count != size) digits.push_back(digit);
+    }
+
+    std::vector<value_type> buffer(size);
+    std::vector<value_type>* src = &data;
+    std::vector<value_type>* dst = &buffer;
+    std::vector<Histogram> offsets(num_threads);
+    for (const size_t digit : digits) {
+      // Per-thread histograms of this digit over the current order.
+      ts::ParallelFor(num_threads, size, [&](size_t t, size_t begin, size_t end) {
+        Histogram& histogram = offsets[t];
+        histogram.fill(0);
+        for (size_t idx = begin; idx < end; ++idx) {
+          ++histogram[Digit((*src)[idx].first, digit)];
+        }
+      });
+
+      // Thread `t` writes bucket `b` after all smaller buckets, and after
+      // bucket `b` of threads before it, which keeps the sort stable.
+      size_t offset = 0;
+      for (size_t bucket = 0; bucket < NumBuckets; ++bucket) {
+        for (size_t t = 0; t < num_threads; ++t) {
+          const size_t count = offsets[t][bucket];
+          offsets[t][bucket] = offset;
+          offset += count;
+        }
+      }
+
+      ts::ParallelFor(num_threads, size, [&](size_t t, size_t begin, size_t end) {
+        Histogram& histogram = offsets[t];
+        const value_type* in = src->data();
+        value_type* out = dst->data();
+        for (size_t idx = begin; idx < end; ++idx) {
+          out[histogram[Digit(in[idx].first, digit)]++] = in[idx];
+        }
+      });
+      std::swap(src, dst);
+    }
+
+    if (src != &data) data.swap(buffer);
+  }
+
+  size_t num_threads_;
+};
+
+// Sorts `data` by key with a `RadixSorter`.
+template <class KeyType, class ValueType>
+void RadixSort(std::vector<std::pair<KeyType, ValueType>>& data, size_t num_threads = 0) {
+  RadixSorter<KeyType, ValueType>(num_threads).Sort(data);
+}
+
+}  // namespace rs
@@ -3,8 +3,10 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <type_traits>
 #include <vector>
 
+#include "../ts/common.h"
 #include "common.h"
 
 namespace rs {
@@ -27,7 +29,9 @@ class RadixSpline {
         num_shift_bits_(num_shift_bits),
         max_error_(max_error),
         radix_table_(std::move(radix_table)),
-        spline_points_(std::move(spline_points)) {}
+        spline_points_(std::move(spline_points)) {
+    PrecomputeSlopes();
+  }
 
   // Returns the estimated position of `key`.
   double GetEstimatedPosition(const KeyType key) const {
@@ -40,6 +44,13 @@ class RadixSpline {
     const Coord<KeyType> down = spline_points_[index - 1];
     const Coord<KeyType> up = spline_points_[index];
 
+#ifdef PLEX_FIXED_POINT_SPLINE
+    if constexpr (HasFixedSlopes()) {
+      // Interpolate in fixed point (see `GetSearchBound`).
+      return static_cast<size_t>(down.y) + fixed_slopes_[index].Interpolate(key - down.x);
+    }
+#endif
+
     // Compute slope.
     const double x_diff = up.x - down.x;
     const double y_diff = up.y - down.y;
@@ -52,22 +63,57 @@ class RadixSpline {
 
   // Returns a search bound [begin, end) around the estimated position.
   SearchBound GetSearchBound(const KeyType key) const {
+    size_t under = max_error_;
+    size_t over = max_error_;
+#ifdef PLEX_FIXED_POINT_SPLINE
+    if constexpr (HasFixedSlopes()) {
+      // Widened by how far fixed-point estimates may be from the
+      // floating-point ones that the error is kept on.
+      under += ts::FixedSlope::UnderSlack;
+      over += ts::FixedSlope::OverSlack;
+    }
+#endif
     const size_t estimate = GetEstimatedPosition(key);
-    const size_t begin = (estimate < max_error_) ? 0 : (estimate - max_error_);
+    const size_t begin = (estimate < over) ? 0 : (estimate - over);
     // `end` is exclusive.
-    const size_t end = (estimate + max_error_ + 2 > num_keys_)
+    const size_t end = (estimate + under + 2 > num_keys_)
                            ? num_keys_
-                           : (estimate + max_error_ + 2);
+                           : (estimate + under + 2);
     return SearchBound{begin, end};
   }
 
   // Returns the size in bytes.
   size_t GetSize() const {
-    return sizeof(*this) + radix_table_.size() * sizeof(uint32_t) +
-           spline_points_.size() * sizeof(Coord<KeyType>);
+    size_t size = sizeof(*this) + radix_table_.size() * sizeof(uint32_t) +
+                  spline_points_.size() * sizeof(Coord<KeyType>);
+#ifdef PLEX_FIXED_POINT_SPLINE
+    size += fixed_slopes_.size() * sizeof(ts::FixedSlope);
+#endif
+    return size;
   }
 
  private:
+  // Whether estimates are interpolated in fixed point with
+  // PLEX_FIXED_POINT_SPLINE: for integer keys of up to 64 bits.
+  static constexpr bool HasFixedSlopes() {
+    return std::is_integral<KeyType>::value && sizeof(KeyType) <= sizeof(uint64_t);
+  }
+
+  // Precomputes the fixed-point slopes of the segments, with
+  // PLEX_FIXED_POINT_SPLINE.
+  void PrecomputeSlopes() {
+#ifdef PLEX_FIXED_POINT_SPLINE
+    if constexpr (HasFixedSlopes()) {
+      fixed_slopes_.assign(spline_points_.size(), ts::FixedSlope());
+      for (size_t idx = 1; idx < spline_points_.size(); ++idx) {
+        const Coord<KeyType> down = spline_points_[idx - 1];
+        const Coord<KeyType> up = spline_points_[idx];
+        fixed_slopes_[idx] = ts::FixedSlope(up.x - down.x, up.y - down.y);
+      }
+    }
+#endif
+  }
+
   // Returns the index of the spline point that marks the end of the spline
   // segment that contains the `key`: `key` ∈ (spline[index - 1], spline[index]]
   size_t GetSplineSegment(const KeyType key) const {
@@ -102,6 +148,10 @@ class RadixSpline {
 
   std::vector<uint32_t> radix_table_;
   std::vector<rs::Coord<KeyType>> spline_points_;
+#ifdef PLEX_FIXED_POINT_SPLINE
+  // The slope of each spline segment, by its last point.
+  std::vector<ts::FixedSlope> fixed_slopes_;
+#endif
 
   template <typename>
   friend class Serializer;
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include "common.h"
+
+namespace rs {
+
+// A read-only `RadixSpline` over a model serialized in the bulk format (see
+// `Serializer::ToBulkBytes`), e.g. inside a memory-mapped or shared buffer.
+// Nothing is copied; the buffer must outlive the view.
+template <class KeyType>
+class RadixSplineView {
+ public:
+  // The bulk format: this header, followed by the radix table and the spline
+  // points as contiguous arrays, each 8-byte aligned.
+  struct Header {
+    static constexpr uint64_t Magic = 0x4b4c554253520000ull;  // "RSBULK"
+    static constexpr uint32_t Version = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t key_size;
+    KeyType min_key;
+    KeyType max_key;
+    uint64_t num_keys;
+    uint64_t num_radix_bits;
+    uint64_t num_shift_bits;
+    uint64_t max_error;
+    uint64_t radix_table_size;
+    uint64_t spline_points_size;
+  };
+
+  RadixSplineView() = default;
+
+  // Maps the model at `data`, of `size` bytes. The header is validated, so
+  // that lookups never read past `size` bytes.
+  RadixSplineView(const char* data, size_t size) {
+    if (reinterpret_cast<uintptr_t>(data) % alignof(Header) != 0) {
+      std::cerr << "Error: RadixSpline bulk model is not 8-byte aligned" << std::endl;
+      exit(1);
+    }
+    const Header& header = *reinterpret_cast<const Header*>(data);
+    if (size < sizeof(Header) || header.magic != Header::Magic) {
+      std::cerr << "Error: not a RadixSpline bulk model" << std::endl;
+      exit(1);
+    }
+    if (header.version != Header::Version || header.key_size != sizeof(KeyType)) {
+      std::cerr << "Error: RadixSpline bulk model has version " << header.version << " and "
+                << header.key_size << "-byte keys, expected " << Header::Version << " and "
+                << sizeof(KeyType) << std::endl;
+      exit(1);
+    }
+    if (header.radix_table_size > size / sizeof(uint32_t) ||
+        header.spline_points_size > size / sizeof(Coord<KeyType>) ||
+        GetBulkSize(header) > size) {
+      std::cerr << "Error: RadixSpline bulk model is truncated" << std::endl;
+      exit(1);
+    }
+    // Every key in (`min_key`, `max_key`) has a prefix with its end in the
+    // radix table.
+    if (header.min_key > header.max_key || header.spline_points_size == 0 ||
+        header.num_shift_bits >= 8 * sizeof(KeyType) ||
+        static_cast<uint64_t>((header.max_key - header.min_key) >> header.num_shift_bits) + 1 >=
+            header.radix_table_size) {
+      std::cerr << "Error: RadixSpline bulk model is corrupt" << std::endl;
+      exit(1);
+    }
+
+    min_key_ = header.min_key;
+    max_key_ = header.max_key;
+    num_keys_ = header.num_keys;
+    num_radix_bits_ = header.num_radix_bits;
+    num_shift_bits_ = header.num_shift_bits;
+    max_error_ = header.max_error;
+    radix_table_size_ = header.radix_table_size;
+    spline_points_size_ = header.spline_points_size;
+    radix_table_ = reinterpret_cast<const uint32_t*>(data + RadixTableOffset(header));
+    spline_points_ =
+        reinterpret_cast<const Coord<KeyType>*>(data + SplinePointsOffset(header));
+  }
+
+  // Returns the estimated position of `key`.
+  double GetEstimatedPosition(const KeyType key) const {
+    // Truncate to data boundaries.
+    if (key <= min_key_) return 0;
+    if (key >= max_key_) return num_keys_ - 1;
+
+    // Find spline segment with `key` ∈ (spline[index - 1], spline[index]].
+    const size_t index = GetSplineSegment(key);
+    const Coord<KeyType> down = spline_points_[index - 1];
+    const Coord<KeyType> up = spline_points_[index];
+
+    // Compute slope.
+    const double x_diff = up.x - down.x;
+    const double y_diff = up.y - down.y;
+    const double slope = y_diff / x_diff;
+
+    // Interpolate.
+    const double key_diff = key - down.x;
+    return std::fma(key_diff, slope, down.y);
+  }
+
+  // Returns a search bound [begin, end) around the estimated position.
+  SearchBound GetSearchBound(const KeyType key) const {
+    const size_t estimate = GetEstimatedPosition(key);
+    const size_t begin = (estimate < max_error_) ? 0 : (estimate - max_error_);
+    // `end` is exclusive.
+    const size_t end = (estimate + max_error_ + 2 > num_keys_)
+                           ? num_keys_
+                           : (estimate + max_error_ + 2);
+    return SearchBound{begin, end};
+  }
+
+  // Returns the size in bytes of the model in the bulk format.
+  size_t GetSize() const {
+    Header header;
+    header.radix_table_size = radix_table_size_;
+    header.spline_points_size = spline_points_size_;
+    return GetBulkSize(header);
+  }
+
+  static size_t RadixTableOffset(const Header& header __attribute__((unused))) {
+    return AlignUp(sizeof(Header));
+  }
+
+  static size_t SplinePointsOffset(const Header& header) {
+    return AlignUp(RadixTableOffset(header) + header.radix_table_size * sizeof(uint32_t));
+  }
+
+  static size_t GetBulkSize(const Header& header) {
+    return SplinePointsOffset(header) + header.spline_points_size * sizeof(Coord<KeyType>);
+  }
+
+ private:
+  static size_t AlignUp(size_t offset) {
+    return (offset + 7) & ~static_cast<size_t>(7);
+  }
+
+  // Returns the index of the spline point that marks the end of the spline
+  // segment that contains the `key`: `key` ∈ (spline[index - 1], spline[index]]
+  size_t GetSplineSegment(const KeyType key) const {
+    // Narrow search range using radix table.
+    const KeyType prefix = (key - min_key_) >> num_shift_bits_;
+    assert(prefix + 1 < radix_table_size_);
+    const uint32_t begin = radix_table_[prefix];
+    const uint32_t end = radix_table_[prefix + 1];
+
+    if (end - begin < 32) {
+      // Do linear search over narrowed range.
+      uint32_t current = begin;
+      while (spline_points_[current].x < key) ++current;
+      return current;
+    }
+
+    // Do binary search over narrowed range.
+    const auto lb = std::lower_bound(
+        spline_points_ + begin, spline_points_ + end, key,
+        [](const Coord<KeyType>& coord, const KeyType key) {
+          return coord.x < key;
+        });
+    return std::distance(spline_points_, lb);
+  }
+
+  KeyType min_key_;
+  KeyType max_key_;
+  size_t num_keys_;
+  size_t num_radix_bits_;
+  size_t num_shift_bits_;
+  size_t max_error_;
+
+  size_t radix_table_size_;
+  size_t spline_points_size_;
+  const uint32_t* radix_table_;
+  const Coord<KeyType>* spline_points_;
+
+  template <typename>
+  friend class Serializer;
+};
+
+}  // namespace rs
@@ -1,8 +1,11 @@
 #pragma once
 
-#include <sstream>
+#include <cassert>
+#include <cstring>
+#include <string>
 
 #include "radix_spline.h"
+#include "radix_spline_view.h"
 
 namespace rs {
 
@@ -11,74 +14,128 @@ class Serializer {
  public:
   // Serializes the `rs` model and appends it to `bytes`.
   static void ToBytes(const RadixSpline<KeyType>& rs, std::string* bytes) {
-    std::stringstream buffer;
-
     // Scalar members.
-    buffer.write(reinterpret_cast<const char*>(&rs.min_key_), sizeof(KeyType));
-    buffer.write(reinterpret_cast<const char*>(&rs.max_key_), sizeof(KeyType));
-    buffer.write(reinterpret_cast<const char*>(&rs.num_keys_), sizeof(size_t));
-    buffer.write(reinterpret_cast<const char*>(&rs.num_radix_bits_),
-                 sizeof(size_t));
-    buffer.write(reinterpret_cast<const char*>(&rs.num_shift_bits_),
-                 sizeof(size_t));
-    buffer.write(reinterpret_cast<const char*>(&rs.max_error_), sizeof(size_t));
+    Append(bytes, &rs.min_key_, sizeof(KeyType));
+    Append(bytes, &rs.max_key_, sizeof(KeyType));
+    Append(bytes, &rs.num_keys_, sizeof(size_t));
+    Append(bytes, &rs.num_radix_bits_, sizeof(size_t));
+    Append(bytes, &rs.num_shift_bits_, sizeof(size_t));
+    Append(bytes, &rs.max_error_, sizeof(size_t));
 
     // Radix table.
     const size_t radix_table_size = rs.radix_table_.size();
-    buffer.write(reinterpret_cast<const char*>(&radix_table_size),
-                 sizeof(size_t));
-    for (size_t i = 0; i < rs.radix_table_.size(); ++i) {
-      buffer.write(reinterpret_cast<const char*>(&rs.radix_table_[i]),
-                   sizeof(uint32_t));
-    }
+    Append(bytes, &radix_table_size, sizeof(size_t));
+    Append(bytes, rs.radix_table_.data(), radix_table_size * sizeof(uint32_t));
 
-    // Spline points.
+    // Spline points, as (x, y) without padding.
     const size_t spline_points_size = rs.spline_points_.size();
-    buffer.write(reinterpret_cast<const char*>(&spline_points_size),
-                 sizeof(size_t));
-    for (size_t i = 0; i < rs.spline_points_.size(); ++i) {
-      buffer.write(reinterpret_cast<const char*>(&rs.spline_points_[i].x),
-                   sizeof(KeyType));
-      buffer.write(reinterpret_cast<const char*>(&rs.spline_points_[i].y),
-                   sizeof(double));
+    Append(bytes, &spline_points_size, sizeof(size_t));
+    if (IsCoordPacked()) {
+      Append(bytes, rs.spline_points_.data(), spline_points_size * sizeof(Coord<KeyType>));
+    } else {
+      for (const auto& coord : rs.spline_points_) {
+        Append(bytes, &coord.x, sizeof(KeyType));
+        Append(bytes, &coord.y, sizeof(double));
+      }
     }
-
-    bytes->append(buffer.str());
   }
 
   static RadixSpline<KeyType> FromBytes(const std::string& bytes) {
-    std::istringstream in(bytes);
+    const char* in = bytes.data();
 
     RadixSpline<KeyType> rs;
 
     // Scalar members.
-    in.read(reinterpret_cast<char*>(&rs.min_key_), sizeof(KeyType));
-    in.read(reinterpret_cast<char*>(&rs.max_key_), sizeof(KeyType));
-    in.read(reinterpret_cast<char*>(&rs.num_keys_), sizeof(size_t));
-    in.read(reinterpret_cast<char*>(&rs.num_radix_bits_), sizeof(size_t));
-    in.read(reinterpret_cast<char*>(&rs.num_shift_bits_), sizeof(size_t));
-    in.read(reinterpret_cast<char*>(&rs.max_error_), sizeof(size_t));
+    Read(&in, &rs.min_key_, sizeof(KeyType));
+    Read(&in, &rs.max_key_, sizeof(KeyType));
+    Read(&in, &rs.num_keys_, sizeof(size_t));
+    Read(&in, &rs.num_radix_bits_, sizeof(size_t));
+    Read(&in, &rs.num_shift_bits_, sizeof(size_t));
+    Read(&in, &rs.max_error_, sizeof(size_t));
 
     // Radix table.
     size_t radix_table_size;
-    in.read(reinterpret_cast<char*>(&radix_table_size), sizeof(size_t));
+    Read(&in, &radix_table_size, sizeof(size_t));
     rs.radix_table_.resize(radix_table_size);
-    for (int i = 0; i < rs.radix_table_.size(); ++i) {
-      in.read(reinterpret_cast<char*>(&rs.radix_table_[i]), sizeof(uint32_t));
-    }
+    Read(&in, rs.radix_table_.data(), radix_table_size * sizeof(uint32_t));
 
     // Spline points.
     size_t spline_points_size;
-    in.read(reinterpret_cast<char*>(&spline_points_size), sizeof(size_t));
+    Read(&in, &spline_points_size, sizeof(size_t));
     rs.spline_points_.resize(spline_points_size);
-    for (int i = 0; i < rs.spline_points_.size(); ++i) {
-      in.read(reinterpret_cast<char*>(&rs.spline_points_[i].x),
-              sizeof(KeyType));
-      in.read(reinterpret_cast<char*>(&rs.spline_points_[i].y), sizeof(double));
+    if (IsCoordPacked()) {
+      Read(&in, rs.spline_points_.data(), spline_points_size * sizeof(Coord<KeyType>));
+    } else {
+      for (auto& coord : rs.spline_points_) {
+        Read(&in, &coord.x, sizeof(KeyType));
+        Read(&in, &coord.y, sizeof(double));
+      }
     }
 
+    assert(in <= bytes.data() + bytes.size());
+    rs.PrecomputeSlopes();
+    return rs;
+  }
+
+  // Serializes the `rs` model in the bulk format (see `RadixSplineView`) and
+  // appends it to `bytes`. All arrays are aligned relative to the start of
+  // the appended model, so a view needs the model to start 8-byte aligned.
+  static void ToBulkBytes(const RadixSpline<KeyType>& rs, std::string* bytes) {
+    using Header = typename RadixSplineView<KeyType>::Header;
+    Header header;
+    header.magic = Header::Magic;
+    header.version = Header::Version;
+    header.key_size = sizeof(KeyType);
+    header.min_key = rs.min_key_;
+    header.max_key = rs.max_key_;
+    header.num_keys = rs.num_keys_;
+    header.num_radix_bits = rs.num_radix_bits_;
+    header.num_shift_bits = rs.num_shift_bits_;
+    header.max_error = rs.max_error_;
+    header.radix_table_size = rs.radix_table_.size();
+    header.spline_points_size = rs.spline_points_.size();
+
+    const size_t start = bytes->size();
+    bytes->resize(start + RadixSplineView<KeyType>::GetBulkSize(header));
+    char* out = &(*bytes)[start];
+    memcpy(out, &header, sizeof(Header));
+    memcpy(out + RadixSplineView<KeyType>::RadixTableOffset(header), rs.radix_table_.data(),
+           header.radix_table_size * sizeof(uint32_t));
+    memcpy(out + RadixSplineView<KeyType>::SplinePointsOffset(header), rs.spline_points_.data(),
+           header.spline_points_size * sizeof(Coord<KeyType>));
+  }
+
+  // Deserializes a model in the bulk format, of `size` bytes, into an owning
+  // `RadixSpline`.
+  static RadixSpline<KeyType> FromBulkBytes(const char* data, size_t size) {
+    const RadixSplineView<KeyType> view(data, size);
+    RadixSpline<KeyType> rs;
+    rs.min_key_ = view.min_key_;
+    rs.max_key_ = view.max_key_;
+    rs.num_keys_ = view.num_keys_;
+    rs.num_radix_bits_ = view.num_radix_bits_;
+    rs.num_shift_bits_ = view.num_shift_bits_;
+    rs.max_error_ = view.max_error_;
+    rs.radix_table_.assign(view.radix_table_, view.radix_table_ + view.radix_table_size_);
+    rs.spline_points_.assign(view.spline_points_, view.spline_points_ + view.spline_points_size_);
+    rs.PrecomputeSlopes();
     return rs;
   }
+
+ private:
+  // Whether `Coord<KeyType>` has no padding, i.e. can be copied in bulk.
+  static constexpr bool IsCoordPacked() {
+    return sizeof(Coord<KeyType>) == sizeof(KeyType) + sizeof(double);
+  }
+
+  static void Append(std::string* bytes, const void* data, size_t size) {
+    bytes->append(reinterpret_cast<const char*>(data), size);
+  }
+
+  static void Read(const char** in, void* data, size_t size) {
+    memcpy(data, *in, size);
+    *in += size;
+  }
 };
 
 }  // namespace rs
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <boost/serialization/array_wrapper.hpp>
+#include <boost/serialization/split_member.hpp>
+
+namespace bit_packing {
+
+// Values are packed back-to-back with a fixed `width` in bits. Any value is
+// read with a single unaligned 64-bit load, hence widths above
+// `MaxPackedWidth` are rounded up to 64 (which is byte-aligned). Buffers need
+// `sizeof(uint64_t)` bytes of zeroed slack at the end.
+static constexpr unsigned MaxPackedWidth = 57;
+
+// Returns the number of bits needed to store any value in [0, `diff`].
+inline unsigned ComputeWidth(uint64_t diff) {
+  if (diff == 0) return 0;
+  const unsigned width = 64 - __builtin_clzll(diff);
+  return (width > MaxPackedWidth) ? 64 : width;
+}
+
+inline size_t NumBytes(size_t count, unsigned width) {
+  return (count * width + 7) >> 3;
+}
+
+inline uint64_t Mask(unsigned width) {
+  assert(width > 0 && width <= 64);
+  return (~0ull) >> (64 - width);
+}
+
+// Stores `value` as the `idx`th entry. `out` must be zero-initialized.
+inline void Store(uint8_t* out, unsigned width, size_t idx, uint64_t value) {
+  if (width == 0) return;
+  const size_t bit = idx * width;
+  uint64_t word;
+  memcpy(&word, out + (bit >> 3), sizeof(uint64_t));
+  word |= value << (bit & 7);
+  memcpy(out + (bit >> 3), &word, sizeof(uint64_t));
+}
+
+// Returns the `idx`th entry.
+inline uint64_t Extract(const uint8_t* in, unsigned width, size_t idx) {
+  if (width == 0) return 0;
+  const size_t bit = idx * width;
+  uint64_t word;
+  memcpy(&word, in + (bit >> 3), sizeof(uint64_t));
+  return (word >> (bit & 7)) & Mask(width);
+}
+
+// Decodes `count` entries and adds `base` to each of them.
+template <class K>
+void Unpack(const uint8_t* in, size_t count, K base, unsigned width, K* out) {
+  if (width == 0) {
+    std::fill(out, out + count, base);
+    return;
+  }
+  size_t idx = 0;
+#ifdef __AVX2__
+  if constexpr (sizeof(K) == sizeof(uint64_t)) {
+    // Four entries at a time: gather the 64-bit words containing each value,
+    // shift the value down, mask it and add `base`.
+    const __m256i mask = _mm256_set1_epi64x(Mask(width));
+    const __m256i seven = _mm256_set1_epi64x(7);
+    const __m256i vbase = _mm256_set1_epi64x(base);
+    const __m256i step = _mm256_set1_epi64x(4ull * width);
+    __m256i bit = _mm256_set_epi64x(3ull * width, 2ull * width, width, 0);
+    for (; idx + 4 <= count; idx += 4) {
+      const __m256i byte = _mm256_srli_epi64(bit, 3);
+      __m256i word = _mm256_i64gather_epi64(reinterpret_cast<const long long*>(in), byte, 1);
+      word = _mm256_srlv_epi64(word, _mm256_and_si256(bit, seven));
+      word = _mm256_add_epi64(_mm256_and_si256(word, mask), vbase);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + idx), word);
+      bit = _mm256_add_epi64(bit, step);
+    }
+  }
+#endif
+  for (; idx < count; ++idx) out[idx] = base + Extract(in, width, idx);
+}
+
+// An in-memory array of non-decreasing values. Every `AnchorInterval`th value
+// is stored in full as an anchor; the values up to the next anchor are stored
+// as bit-packed deltas to it, with the minimal width of their group. Any
+// value is decoded in O(1).
+template <class T>
+class AnchoredArray {
+ public:
+  static constexpr size_t AnchorInterval = 64;
+
+  AnchoredArray() : size_(0) {}
+
+  // Builds from `get(0)`, ..., `get(size - 1)`.
+  template <class Getter>
+  AnchoredArray(size_t size, Getter get) : size_(size) {
+    anchors_.reserve((size + AnchorInterval - 1) / AnchorInterval);
+    for (size_t first = 0; first < size; first += AnchorInterval) {
+      const size_t count = std::min(AnchorInterval, size - first);
+      const T base = get(first);
+      const T last = get(first + count - 1);
+      assert(last >= base);
+      const unsigned width = ComputeWidth(last - base);
+
+      const size_t offset = payload_.size();
+      payload_.resize(offset + NumBytes(count, width) + sizeof(uint64_t), 0);
+      for (size_t idx = 0; idx < count; ++idx) {
+        Store(payload_.data() + offset, width, idx, get(first + idx) - base);
+      }
+      payload_.resize(offset + NumBytes(count, width));
+      anchors_.push_back({base, width, offset});
+    }
+    payload_.resize(payload_.size() + sizeof(uint64_t), 0);
+  }
+
+  T operator[](size_t idx) const {
+    const Anchor& anchor = anchors_[idx / AnchorInterval];
+    return anchor.base + Extract(payload_.data() + anchor.offset, anchor.width,
+                                 idx % AnchorInterval);
+  }
+
+  size_t size() const { return size_; }
+
+  // Returns the size in bytes.
+  size_t GetSize() const {
+    return sizeof(*this) + anchors_.size() * sizeof(Anchor) + payload_.size();
+  }
+
+ private:
+  struct Anchor {
+    T base;
+    unsigned width;
+    size_t offset;  // Byte offset into `payload_`.
+  };
+
+  size_t size_;
+  std::vector<Anchor> anchors_;
+  std::vector<uint8_t> payload_;
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void save(Archive & ar, const unsigned int version __attribute__((unused))) const {
+    ar << this->size_;
+    size_t anchors_size = this->anchors_.size();
+    size_t payload_size = this->payload_.size();
+    ar << anchors_size;
+    ar << payload_size;
+    ar << boost::serialization::make_array(
+        reinterpret_cast<const char*>(this->anchors_.data()), anchors_size * sizeof(Anchor));
+    ar << boost::serialization::make_array(this->payload_.data(), payload_size);
+  }
+
+  template<class Archive>
+  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+    ar >> this->size_;
+    size_t anchors_size, payload_size;
+    ar >> anchors_size;
+    ar >> payload_size;
+    this->anchors_.resize(anchors_size);
+    this->payload_.resize(payload_size);
+    ar >> boost::serialization::make_array(
+        reinterpret_cast<char*>(this->anchors_.data()), anchors_size * sizeof(Anchor));
+    ar >> boost::serialization::make_array(this->payload_.data(), payload_size);
+  }
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+}  // namespace bit_packing
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "bit_packing.h"
+#include "mmap_struct.h"
+
+namespace mmap_struct {
+
+/* BlockCompressedVector: mmap-based, block-compressed array of sorted keys */
+
+// Keys are split into blocks of `BlockSize` consecutive keys. Each block is
+// stored frame-of-reference encoded: its first key (`base`) in the block
+// header, and `key - base` bit-packed with the minimal width of the block
+// (see `bit_packing`).
+// Searches only decode the single block that contains the answer.
+template<class K>
+class BlockCompressedVector {
+ public:
+  static constexpr size_t BlockSize = 128;
+
+  // A block header.
+  struct Block {
+    K base;
+    unsigned width;
+    size_t offset;  // Byte offset into the payload.
+  };
+
+  BlockCompressedVector() : size_(0) {}
+  BlockCompressedVector(const BlockCompressedVector& other) = delete;
+  BlockCompressedVector& operator=(const BlockCompressedVector& other) = delete;
+  BlockCompressedVector& operator=(BlockCompressedVector&& other) {
+    this->size_ = other.size_;
+    this->blocks_ = std::move(other.blocks_);
+    this->payload_ = std::move(other.payload_);
+    other.size_ = 0;
+    return *this;
+  }
+
+  BlockCompressedVector(const std::vector<K>& source, fs::path filepath)  // Build new file from vector
+      : size_(source.size()) {
+    std::vector<Block> blocks;
+    std::vector<uint8_t> payload;
+    blocks.reserve((source.size() + BlockSize - 1) / BlockSize);
+    for (size_t first = 0; first < source.size(); first += BlockSize) {
+      const size_t count = std::min(BlockSize, source.size() - first);
+      const K base = source[first];
+      assert(std::is_sorted(source.begin() + first, source.begin() + first + count));
+      const unsigned width = bit_packing::ComputeWidth(source[first + count - 1] - base);
+
+      // `Store` writes whole 64-bit words, so temporarily over-allocate.
+      const size_t offset = payload.size();
+      payload.resize(offset + bit_packing::NumBytes(count, width) + sizeof(uint64_t), 0);
+      for (size_t idx = 0; idx < count; ++idx) {
+        bit_packing::Store(payload.data() + offset, width, idx, source[first + idx] - base);
+      }
+      payload.resize(offset + bit_packing::NumBytes(count, width));
+      blocks.push_back({base, width, offset});
+    }
+    // Padding, such that unpacking can always read 8 bytes at once.
+    payload.resize(payload.size() + sizeof(uint64_t), 0);
+
+    this->blocks_ = LazyVector<Block>(blocks, make_blocks_path(filepath));
+    this->payload_ = LazyVector<uint8_t>(payload, make_payload_path(filepath));
+  }
+
+  BlockCompressedVector(fs::path filepath, const size_t data_size)  // Load from existing file
+      : size_(data_size),
+        blocks_(make_blocks_path(filepath), (data_size + BlockSize - 1) / BlockSize) {
+    // The payload ends after the last block plus the padding.
+    const size_t last_count = data_size - (this->blocks_.size() - 1) * BlockSize;
+    const size_t payload_size = this->blocks_.back().offset +
+        bit_packing::NumBytes(last_count, this->blocks_.back().width) + sizeof(uint64_t);
+    this->payload_ = LazyVector<uint8_t>(make_payload_path(filepath), payload_size);
+  }
+
+  // Returns the position of the first key not less than `key` in [begin, end).
+  size_t lower_bound(K key, size_t begin, size_t end) const {
+    if (begin >= end) return end;
+
+    // Find the first block in (`begin`'s block, `end - 1`'s block] that starts
+    // at a key >= `key`. The answer is in the block before it, or at its start.
+    const Block* blocks = this->blocks_.data();
+    const size_t first_block = begin / BlockSize;
+    const size_t last_block = (end - 1) / BlockSize;
+    const Block* next = std::lower_bound(
+        blocks + first_block + 1, blocks + last_block + 1, key,
+        [](const Block& block, const K key) { return block.base < key; });
+    const size_t block = (next - blocks) - 1;
+
+    // Decode only that block.
+    K buffer[BlockSize];
+    const size_t block_begin = block * BlockSize;
+    const size_t count = DecodeBlock(block, buffer);
+    const size_t lo = std::max(begin, block_begin) - block_begin;
+    const size_t hi = std::min(end - block_begin, count);
+    return block_begin + (std::lower_bound(buffer + lo, buffer + hi, key) - buffer);
+  }
+
+  // Random access to a single key, without decoding its block.
+  K operator[](size_t index) const {
+    const Block& block = this->blocks_.data()[index / BlockSize];
+    return block.base + bit_packing::Extract(this->payload_.data() + block.offset, block.width,
+                                index % BlockSize);
+  }
+
+  // Decodes the `block`th block into `out` and returns the number of keys.
+  size_t DecodeBlock(size_t block, K* out) const {
+    const Block& header = this->blocks_.data()[block];
+    const size_t count = std::min(BlockSize, size_ - block * BlockSize);
+    bit_packing::Unpack(this->payload_.data() + header.offset, count, header.base, header.width, out);
+    return count;
+  }
+
+  size_t size() const {
+    return this->size_;
+  }
+
+  K front() const {
+    return (*this)[0];
+  }
+
+  K back() const {
+    return (*this)[this->size() - 1];
+  }
+
+  // Returns the size in bytes on disk.
+  size_t GetSizeInByte() const {
+    return this->blocks_.size() * sizeof(Block) + this->payload_.size();
+  }
+
+ private:
+  static fs::path make_blocks_path(fs::path filepath) {
+    return filepath.string() + "_blocks";
+  }
+
+  static fs::path make_payload_path(fs::path filepath) {
+    return filepath.string() + "_payload";
+  }
+
+  size_t size_;
+  LazyVector<Block> blocks_;
+  LazyVector<uint8_t> payload_;
+};
+
+}  // mmap_struct
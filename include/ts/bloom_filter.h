@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include <boost/serialization/split_member.hpp>
+
+#include "key_traits.h"
+#include "mmap_struct.h"
+
+namespace mmap_struct {
+
+/* BlockedBloomFilter: mmap-based Bloom filter with one cache line per key */
+
+// Each key sets `num_hashes` bits of a single 512-bit block, chosen by a hash
+// of the key, so a query reads a single cache line of the mmap'd file. Keys
+// are hashed by their encoding (see `ts::HashKey`).
+// A filter built with 0 bits per key is disabled: every key may be contained.
+template<class K>
+class BlockedBloomFilter {
+ public:
+  static constexpr size_t BlockBits = 512;
+  static constexpr size_t WordsPerBlock = BlockBits / 64;
+
+  BlockedBloomFilter() : num_blocks_(0), num_hashes_(0) {}
+
+  BlockedBloomFilter(fs::path filepath) : num_blocks_(0), num_hashes_(0), filepath_(filepath) {}
+
+  BlockedBloomFilter& operator=(BlockedBloomFilter&& other) {
+    this->num_blocks_ = other.num_blocks_;
+    this->num_hashes_ = other.num_hashes_;
+    this->filepath_ = std::move(other.filepath_);
+    this->words_ = std::move(other.words_);
+    other.num_blocks_ = 0;
+    return *this;
+  }
+
+  // Build new file from the `num_keys` keys `key_at(idx)`, with about
+  // `bits_per_key` bits per key.
+  template <class KeyAt>
+  BlockedBloomFilter(size_t num_keys, KeyAt key_at, size_t bits_per_key, fs::path filepath)
+      : num_blocks_(0), num_hashes_(0), filepath_(filepath) {
+    if (bits_per_key == 0) return;
+    num_blocks_ = std::max<size_t>(1, (num_keys * bits_per_key + BlockBits - 1) / BlockBits);
+    // The optimal number of hashes for a standard Bloom filter, ln(2) * bits_per_key.
+    num_hashes_ = std::min<unsigned>(16, std::max<unsigned>(1, std::lround(bits_per_key * 0.693)));
+
+    std::vector<uint64_t> words(num_blocks_ * WordsPerBlock, 0);
+    for (size_t idx = 0; idx < num_keys; ++idx) {
+      const uint64_t hash = ts::HashKey(key_at(idx));
+      uint64_t* block = words.data() + GetBlock(hash) * WordsPerBlock;
+      for (unsigned i = 0; i < num_hashes_; ++i) {
+        const unsigned bit = GetBit(hash, i);
+        block[bit / 64] |= uint64_t(1) << (bit % 64);
+      }
+    }
+    std::cout << "Built filter of " << GetSizeInByte() << " bytes ("
+              << static_cast<double>(GetSizeInByte() * 8) / std::max<size_t>(1, num_keys)
+              << " bits per key), expected false-positive rate " << ComputeFalsePositiveRate(words)
+              << std::endl;
+    this->words_ = LazyVector<uint64_t>(words, filepath_);
+  }
+
+  // Returns false only if `key` is not in the filter.
+  bool MayContain(K key) const {
+    if (num_blocks_ == 0) return true;
+    const uint64_t hash = ts::HashKey(key);
+    const uint64_t* block = this->words_.data() + GetBlock(hash) * WordsPerBlock;
+    for (unsigned i = 0; i < num_hashes_; ++i) {
+      const unsigned bit = GetBit(hash, i);
+      if (!(block[bit / 64] & (uint64_t(1) << (bit % 64)))) return false;
+    }
+    return true;
+  }
+
+  bool IsEnabled() const { return num_blocks_ > 0; }
+
+  // Returns the size in bytes on disk.
+  size_t GetSizeInByte() const {
+    return num_blocks_ * BlockBits / 8;
+  }
+
+ private:
+  // The high bits of `hash` pick the block.
+  size_t GetBlock(uint64_t hash) const {
+    return (static_cast<__uint128_t>(hash) * num_blocks_) >> 64;
+  }
+
+  // Returns the `i`th bit in the block, double hashed from the two halves of
+  // `hash`.
+  static unsigned GetBit(uint64_t hash, unsigned i) {
+    const uint32_t h1 = static_cast<uint32_t>(hash);
+    const uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+    return (h1 + i * h2) % BlockBits;
+  }
+
+  // Returns the probability that a key not in the filter passes, averaged
+  // over the blocks.
+  double ComputeFalsePositiveRate(const std::vector<uint64_t>& words) const {
+    double rate = 0;
+    for (size_t block = 0; block < num_blocks_; ++block) {
+      size_t num_set = 0;
+      for (size_t word = 0; word < WordsPerBlock; ++word) {
+        num_set += __builtin_popcountll(words[block * WordsPerBlock + word]);
+      }
+      rate += std::pow(static_cast<double>(num_set) / BlockBits, num_hashes_);
+    }
+    return rate / num_blocks_;
+  }
+
+  size_t num_blocks_;
+  unsigned num_hashes_;
+  fs::path filepath_;
+  LazyVector<uint64_t> words_;
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void save(Archive & ar, const unsigned int version __attribute__((unused))) const {
+    ar << this->num_blocks_;
+    ar << this->num_hashes_;
+  }
+
+  template<class Archive>
+  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+    ar >> this->num_blocks_;
+    ar >> this->num_hashes_;
+    if (this->num_blocks_ > 0) {
+      this->words_ = LazyVector<uint64_t>(this->filepath_, this->num_blocks_ * WordsPerBlock);
+    }
+  }
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+}  // mmap_struct
@@ -6,38 +6,239 @@
 #include <map>
 #include <optional>
 #include <fstream>
+#include <string>
+
+#include <boost/serialization/array_wrapper.hpp>
 
 #include "ts_cht/builder.h"
 #include "ts_cht/cht.h"
 #include "common.h"
+#include "error_profile.h"
+#include "key_traits.h"
 #include "ts.h"
 
 #include "mmap_struct.h"
 
 namespace ts {
 
-// Builds a `TrieSpline`.
+// Builds a `TrieSpline`. The spline is built over the encoded keys (see
+// `KeyTraits`).
 template <class KeyType>
 class Builder {
  public:
+  using Traits = KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+
   Builder(KeyType min_key, KeyType max_key, size_t spline_max_error, fs::path root_path)
-      : min_key_(min_key),
-        max_key_(max_key),
-        spline_max_error_(spline_max_error),
+      : Builder(min_key, max_key, ErrorProfile<KeyType>(spline_max_error), root_path) {}
+
+  // Builds with the error of `profile` for each key.
+  Builder(KeyType min_key, KeyType max_key, ErrorProfile<KeyType> profile, fs::path root_path)
+      : min_key_(Traits::Encode(min_key)),
+        max_key_(Traits::Encode(max_key)),
+        spline_max_error_(profile.GetMaxError()),
+        profile_(std::move(profile)),
+        variable_error_(!profile_.IsUniform()),
         curr_num_keys_(0),
         curr_num_distinct_keys_(0),
-        prev_key_(min_key),
+        prev_key_(min_key_),
         prev_position_(0),
-        chtb_(min_key, max_key),
+        chtb_(min_key_, max_key_),
         root_path_(root_path) {}
 
   // Adds a key. Assumes that keys are stored in a dense array.
   void AddKey(KeyType key) {
     if (curr_num_keys_ == 0) {
-      AddKey(key, /*position=*/0);
+      AddEncodedKey(Traits::Encode(key), /*position=*/0);
       return;
     }
-    AddKey(key, prev_position_ + 1);
+    AddEncodedKey(Traits::Encode(key), prev_position_ + 1);
+  }
+
+  // Returns the number of keys added so far. After resuming from a checkpoint,
+  // this is the offset in the input of the next key to add.
+  size_t GetNumKeys() const { return curr_num_keys_; }
+
+  // Saves the build state to `filepath`, atomically replacing an earlier
+  // checkpoint there. `input` identifies the input of the build (e.g., its
+  // file and number of keys), for `LoadCheckpoint` to check.
+  void SaveCheckpoint(fs::path filepath, const std::string& input = "") const {
+    fs::path temp_path = filepath;
+    temp_path += ".tmp";
+    {
+      std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+      boost::archive::binary_oarchive oa(ofs);
+      unsigned version = CheckpointVersion;
+      oa << version;
+      oa << input;
+      oa << min_key_;
+      oa << max_key_;
+      const auto& boundaries = profile_.GetBoundaries();
+      const auto& errors = profile_.GetErrors();
+      oa << boundaries.size();
+      oa << boost::serialization::make_array(reinterpret_cast<const char*>(boundaries.data()),
+                                             boundaries.size() * sizeof(Key));
+      oa << errors.size();
+      oa << boost::serialization::make_array(errors.data(), errors.size());
+      SaveState(oa);
+      ofs.flush();
+      if (!ofs) {
+        std::cerr << "Error writing checkpoint " << temp_path << std::endl;
+        exit(1);
+      }
+    }
+    fs::rename(temp_path, filepath);
+  }
+
+  // Resumes a build from a checkpoint saved by `SaveCheckpoint`. The next key
+  // to add is the one at offset `GetNumKeys()` in the input. The checkpoint
+  // must have been saved for the same `input` by a builder constructed with
+  // the same keys and errors, or the build fails rather than resuming with
+  // the checkpoint's.
+  static Builder LoadCheckpoint(fs::path filepath, KeyType min_key, KeyType max_key,
+                                const ErrorProfile<KeyType>& profile, const std::string& input,
+                                fs::path root_path) {
+    std::ifstream ifs(filepath, std::ios::binary);
+    if (!ifs.is_open()) {
+      std::cerr << "Error read-opening checkpoint " << filepath << std::endl;
+      exit(1);
+    }
+    boost::archive::binary_iarchive ia(ifs);
+    unsigned version;
+    ia >> version;
+    if (version != CheckpointVersion) {
+      std::cerr << "Error: checkpoint " << filepath << " has version " << version
+                << ", expected " << CheckpointVersion << std::endl;
+      exit(1);
+    }
+    std::string saved_input;
+    ia >> saved_input;
+    if (saved_input != input) {
+      std::cerr << "Error: checkpoint " << filepath << " was saved for input '" << saved_input
+                << "', not '" << input << "'" << std::endl;
+      exit(1);
+    }
+    Key saved_min_key, saved_max_key;
+    size_t num_boundaries, num_errors;
+    ia >> saved_min_key;
+    ia >> saved_max_key;
+    if (saved_min_key != Traits::Encode(min_key) || saved_max_key != Traits::Encode(max_key)) {
+      std::cerr << "Error: checkpoint " << filepath << " was saved for another key range" << std::endl;
+      exit(1);
+    }
+    ia >> num_boundaries;
+    std::vector<Key> boundaries(num_boundaries);
+    ia >> boost::serialization::make_array(reinterpret_cast<char*>(boundaries.data()),
+                                           num_boundaries * sizeof(Key));
+    ia >> num_errors;
+    std::vector<size_t> errors(num_errors);
+    ia >> boost::serialization::make_array(errors.data(), num_errors);
+    if (boundaries != profile.GetBoundaries() || errors != profile.GetErrors()) {
+      const size_t saved_max_error = *std::max_element(errors.begin(), errors.end());
+      std::cerr << "Error: checkpoint " << filepath << " was saved with other spline errors";
+      if (saved_max_error != profile.GetMaxError()) {
+        std::cerr << " (max error " << saved_max_error << ", not " << profile.GetMaxError() << ")";
+      }
+      std::cerr << std::endl;
+      exit(1);
+    }
+    Builder builder(min_key, max_key, profile, root_path);
+    builder.LoadState(ia);
+    std::cout << "Resumed TS build from " << filepath << " at key " << builder.curr_num_keys_
+              << " with " << builder.spline_points_.size() << " spline points" << std::endl;
+    return builder;
+  }
+
+  // Fits an error profile to the sorted data `keys` and a sample of `queries`,
+  // in any order. The keys are split into `num_regions` regions of about equal
+  // size, and the spline is built over them for each candidate error (powers
+  // of two up to `MaxErrorFactor` * `spline_max_error`) to count the spline
+  // points of each region. The errors are then chosen per region to minimize
+  // the expected log2 of the search bound under the queries, with no more
+  // spline points than a uniform `spline_max_error`.
+  static constexpr size_t MaxErrorFactor = 16;
+
+  static ErrorProfile<KeyType> ProfileErrors(const std::vector<KeyType>& keys,
+                                             const std::vector<KeyType>& queries,
+                                             size_t spline_max_error, size_t num_regions = 256) {
+    if (keys.empty() || queries.empty() || spline_max_error == 0) {
+      return ErrorProfile<KeyType>(spline_max_error);
+    }
+
+    // Regions of about equal size, without empty ones.
+    std::vector<Key> boundaries;
+    for (size_t r = 1; r < num_regions; ++r) {
+      const Key boundary = Traits::Encode(keys[r * keys.size() / num_regions]);
+      if (boundary > (boundaries.empty() ? Traits::Encode(keys.front()) : boundaries.back())) {
+        boundaries.push_back(boundary);
+      }
+    }
+    num_regions = boundaries.size() + 1;
+    const ErrorProfile<KeyType> regions(boundaries, std::vector<size_t>(num_regions));
+
+    // Fraction of the queries in each region, smoothed towards uniform so
+    // that regions without sampled queries keep a bounded error.
+    std::vector<double> weights(num_regions, 0);
+    for (const KeyType query : queries) weights[regions.GetRegion(Traits::Encode(query))] += 1;
+    const double prior = 0.5 * num_regions;
+    for (double& weight : weights) weight = (weight + 0.5) / (queries.size() + prior);
+
+    // Spline points of each region for each candidate error.
+    std::vector<size_t> candidates;
+    for (size_t error = 1; error < MaxErrorFactor * spline_max_error; error *= 2) {
+      if (error > spline_max_error && candidates.back() < spline_max_error) {
+        candidates.push_back(spline_max_error);
+      }
+      candidates.push_back(error);
+    }
+    candidates.push_back(MaxErrorFactor * spline_max_error);
+    size_t uniform = 0;
+    std::vector<std::vector<size_t>> num_points(candidates.size(), std::vector<size_t>(num_regions));
+    for (size_t c = 0; c < candidates.size(); ++c) {
+      if (candidates[c] == spline_max_error) uniform = c;
+      Builder builder(keys.front(), keys.back(), candidates[c], fs::path());
+      for (const KeyType key : keys) builder.AddKey(key);
+      for (const Coord<Key>& point : builder.spline_points_) {
+        ++num_points[c][regions.GetRegion(point.x)];
+      }
+    }
+    size_t budget = 0;
+    for (size_t r = 0; r < num_regions; ++r) budget += num_points[uniform][r];
+
+    // Lagrangian relaxation: each region minimizes its weighted lookup cost
+    // plus `lambda` per spline point, with the smallest `lambda` that meets
+    // the budget.
+    std::vector<size_t> choice(num_regions);
+    const auto Choose = [&](double lambda) {
+      size_t total = 0;
+      for (size_t r = 0; r < num_regions; ++r) {
+        double best_cost = std::numeric_limits<double>::max();
+        for (size_t c = 0; c < candidates.size(); ++c) {
+          const double cost = weights[r] * std::log2(2 * candidates[c] + 2) + lambda * num_points[c][r];
+          if (cost < best_cost) {
+            best_cost = cost;
+            choice[r] = c;
+          }
+        }
+        total += num_points[choice[r]][r];
+      }
+      return total;
+    };
+    double lo = 0, hi = 1.0 / budget;
+    while (Choose(hi) > budget) hi *= 2;
+    for (unsigned iteration = 0; iteration < 64; ++iteration) {
+      const double mid = (lo + hi) / 2;
+      if (Choose(mid) > budget) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    Choose(hi);
+
+    std::vector<size_t> errors(num_regions);
+    for (size_t r = 0; r < num_regions; ++r) errors[r] = candidates[choice[r]];
+    return ErrorProfile<KeyType>(std::move(boundaries), std::move(errors));
   }
 
   // Finalizes the construction and returns a read-only `TrieSpline`.
@@ -45,68 +246,58 @@ class Builder {
     // Last key needs to be equal to `max_key_`.
     assert(curr_num_keys_ == 0 || prev_key_ == max_key_);
 
-    // Ensure that `prev_key_` (== `max_key_`) is last key on spline.
+    // Ensure that `prev_key_` (== `max_key_`) is last key on spline, at the
+    // position of its first occurrence.
     if (curr_num_keys_ > 0 && spline_points_.back().x != prev_key_)
-      AddKeyToSpline(prev_key_, prev_position_);
+      AddKeyToSpline(prev_key_, prev_point_.y);
 
     // Find tuning.
     std::vector<Statistics> statistics;
     ComputeStatistics(statistics);
     auto tuning = InferTuning(statistics);
     
-    // Finalize CHT
-    auto cht_ = chtb_.Finalize(tuning.numBins, tuning.treeMaxError);
+    // Finalize CHT, directly over the keys of the spline points
+    ts_cht::KeyView<Key> spline_keys(&spline_points_.data()->x, spline_points_.size(),
+                                     sizeof(Coord<Key>));
+    auto cht_ = chtb_.Finalize(tuning.numBins, tuning.treeMaxError, spline_keys);
 
     // And return the read-only instance
     return TrieSpline<KeyType>(min_key_, max_key_, curr_num_keys_, spline_max_error_,
-                               std::move(cht_), std::move(spline_points_), root_path_);
+                               std::move(cht_), std::move(spline_points_),
+                               segment_errors_, root_path_);
   }
 
  private:
-  using Interval = std::pair<unsigned, unsigned>;
+  using Interval = std::pair<size_t, size_t>;
   using Statistics = ts::Statistics;
 
-  static unsigned ComputeLog(uint32_t n, bool round = false) {
-    assert(n);
-    return 31 - __builtin_clz(n) + (round ? ((n & (n - 1)) != 0) : 0);
-  }
-
-  static unsigned ComputeLog(uint64_t n, bool round = false) {
+  // For `uint32_t`, `uint64_t` and `__uint128_t`.
+  template <class T>
+  static unsigned ComputeLog(T n, bool round = false) {
     assert(n);
-    return 63 - __builtin_clzl(n) + (round ? ((n & (n - 1)) != 0) : 0);
+    return sizeof(T) * 8 - 1 - CountLeadingZeros(n) + (round ? ((n & (n - 1)) != 0) : 0);
   }
 
-  static unsigned ComputeLcp(uint32_t x, uint32_t y) {
-    return __builtin_clz(x ^ y);
-  }
-
-  static unsigned ComputeLcp(uint64_t x, uint64_t y) {
-    return __builtin_clzl(x ^ y);
+  static unsigned ComputeLcp(Key x, Key y) {
+    return CountLeadingZeros(x ^ y);
   }
 
   // Returns the number of shift bits based on the `diff` between the largest
-  // and the smallest key. KeyType == uint32_t.
-  static size_t GetNumShiftBits(uint32_t diff, size_t num_radix_bits) {
-    const uint32_t clz = __builtin_clz(diff);
-    if ((32 - clz) < num_radix_bits) return 0;
-    return 32 - num_radix_bits - clz;
-  }
-  
-  // KeyType == uint64_t.
-  static size_t GetNumShiftBits(uint64_t diff, size_t num_radix_bits) {
-    const uint32_t clzl = __builtin_clzl(diff);
-    if ((64 - clzl) < num_radix_bits) return 0;
-    return 64 - num_radix_bits - clzl;
+  // and the smallest key.
+  static size_t GetNumShiftBits(Key diff, size_t num_radix_bits) {
+    const size_t num_bits = sizeof(Key) * 8 - CountLeadingZeros(diff);
+    if (num_bits < num_radix_bits) return 0;
+    return num_bits - num_radix_bits;
   }
 
   // `int(ceil(log_2(distance)))`. I
-  static size_t ComputeCost(uint32_t value) {
+  static size_t ComputeCost(uint64_t value) {
 		assert(value);
     if (value == 1) return 1;
-    return 31 - __builtin_clz(value) + ((value & (value - 1)) != 0);
+    return ComputeLog(value, true);
   }
 
-  void AddKey(KeyType key, size_t position) {
+  void AddEncodedKey(Key key, size_t position) {
     assert(key >= min_key_ && key <= max_key_);
     // Keys need to be monotonically increasing.
     assert(key >= prev_key_);
@@ -120,9 +311,56 @@ class Builder {
     prev_position_ = position;
   }
 
-  void AddKeyToSpline(KeyType key, double position) {
+  void AddKeyToSpline(Key key, double position) {
+    if (spline_points_.empty()) {
+      segment_errors_.push_back({0, 0});
+    } else {
+      segment_errors_.push_back(MeasureSegment(spline_points_.back(), {key, position}));
+    }
     spline_points_.push_back({key, position});
-    AddKeyToCHT(key);
+    under_hull_.clear();
+    over_hull_.clear();
+  }
+
+  /* Measured errors of the spline segments */
+
+  // A key `x` in (down.x, up.x] is estimated by the segment from `down` to
+  // `up`. Its lower bound position is that of the first key `b` >= `x`: at
+  // most the estimate at `b`'s predecessor `a` plus the under-estimate of the
+  // point (a, position of b), and at least the estimate at `b` minus the
+  // over-estimate of the point (b, position of b). Both maxima over the
+  // segment are taken on the convex hulls of these points, which is all that
+  // is kept of them while the keys stream by.
+
+  // Adds the CDF point (`key`, `position`) of a key after the first.
+  void AddToHulls(Key key, double position) {
+    AddToHull(under_hull_, {prev_key_, position}, /*upper=*/true);
+    AddToHull(over_hull_, {key, position}, /*upper=*/false);
+  }
+
+  // Andrew's monotone chain, with strictly increasing x.
+  static void AddToHull(std::vector<Coord<Key>>& hull, Coord<Key> point, bool upper) {
+    while (hull.size() >= 2) {
+      const Coord<Key>& o = hull[hull.size() - 2];
+      const Coord<Key>& a = hull.back();
+      const long double cross =
+          static_cast<long double>(a.x - o.x) * (static_cast<long double>(point.y) - o.y) -
+          (static_cast<long double>(a.y) - o.y) * static_cast<long double>(point.x - o.x);
+      if (upper ? (cross < 0) : (cross > 0)) break;
+      hull.pop_back();
+    }
+    hull.push_back(point);
+  }
+
+  // Returns the largest under- and over-estimate by the segment from `down` to
+  // `up`, interpolating as `TrieSpline` does.
+  std::pair<size_t, size_t> MeasureSegment(const Coord<Key>& down, const Coord<Key>& up) const {
+    const double slope = (up.y - down.y) / static_cast<double>(up.x - down.x);
+    const auto Estimate = [&](Key key) { return std::fma(static_cast<double>(key - down.x), slope, down.y); };
+    double under = 0, over = 0;
+    for (const Coord<Key>& point : under_hull_) under = std::max(under, point.y - Estimate(point.x));
+    for (const Coord<Key>& point : over_hull_) over = std::max(over, Estimate(point.x) - point.y);
+    return {static_cast<size_t>(std::ceil(under)), static_cast<size_t>(std::ceil(over))};
   }
 
   enum Orientation { Collinear, CW, CCW };
@@ -138,20 +376,20 @@ class Builder {
     return Orientation::Collinear;
   };
 
-  void SetUpperLimit(KeyType key, double position) {
+  void SetUpperLimit(Key key, double position) {
     upper_limit_ = {key, position};
   }
-  void SetLowerLimit(KeyType key, double position) {
+  void SetLowerLimit(Key key, double position) {
     lower_limit_ = {key, position};
   }
-  void RememberPreviousCDFPoint(KeyType key, double position) {
+  void RememberPreviousCDFPoint(Key key, double position) {
     prev_point_ = {key, position};
   }
 
   // Implementation is based on `GreedySplineCorridor` from:
   // T. Neumann and S. Michel. Smooth interpolating histograms with error
   // guarantees. [BNCOD'08]
-  void PossiblyAddKeyToSpline(KeyType key, double position) {
+  void PossiblyAddKeyToSpline(Key key, double position) {
     if (curr_num_keys_ == 0) {
       // Add first CDF point to spline.
       AddKeyToSpline(key, position);
@@ -167,25 +405,24 @@ class Builder {
 
     // New CDF point.
     ++curr_num_distinct_keys_;
+    const size_t error = variable_error_ ? profile_.GetError(key, region_) : spline_max_error_;
 
     if (curr_num_distinct_keys_ == 2) {
       // Initialize `upper_limit_` and `lower_limit_` using the second CDF
       // point.
-      SetUpperLimit(key, position + spline_max_error_);
-      SetLowerLimit(key, (position < spline_max_error_)
-                             ? 0
-                             : position - spline_max_error_);
+      SetUpperLimit(key, position + error);
+      SetLowerLimit(key, (position < error) ? 0 : position - error);
+      AddToHulls(key, position);
       RememberPreviousCDFPoint(key, position);
       return;
     }
 
     // `B` in algorithm.
-    const Coord<KeyType>& last = spline_points_.back();
+    const Coord<Key>& last = spline_points_.back();
 
     // Compute current `upper_y` and `lower_y`.
-    const double upper_y = position + spline_max_error_;
-    const double lower_y =
-        (position < spline_max_error_) ? 0 : position - spline_max_error_;
+    const double upper_y = position + error;
+    const double lower_y = (position < error) ? 0 : position - error;
 
     // Compute differences.
     assert(upper_limit_.x >= last.x);
@@ -232,11 +469,10 @@ class Builder {
       }
     }
 
+    AddToHulls(key, position);
     RememberPreviousCDFPoint(key, position);
   }
 
-  void AddKeyToCHT(KeyType key) { chtb_.AddKey(key); }
-
   void ComputeRadixTableStatistics(std::vector<Statistics>& statistics) {
     static constexpr unsigned maxNumRadixBits = 30;
     
@@ -251,15 +487,15 @@ class Builder {
     }
     
     // And compute the costs.
-    for (unsigned splineIndex = 1, limit = spline_points_.size(); splineIndex != limit; ++splineIndex) {
+    for (size_t splineIndex = 1, limit = spline_points_.size(); splineIndex != limit; ++splineIndex) {
       for (unsigned radix = 1; radix <= maxNumRadixBits; ++radix) {
-        const KeyType currPrefix = (spline_points_[splineIndex].x - min_key_) >> radixAnalyzer[radix].shiftBits;
+        const Key currPrefix = (spline_points_[splineIndex].x - min_key_) >> radixAnalyzer[radix].shiftBits;
         
         // New prefix?
         if (currPrefix != radixAnalyzer[radix].prevPrefix) {
           // Then compute statistics.
           assert(splineIndex);
-          const unsigned prevSplineIndex = radixAnalyzer[radix].prevSplineIndex;
+          const size_t prevSplineIndex = radixAnalyzer[radix].prevSplineIndex;
           const size_t numDataKeys = spline_points_[splineIndex].y - spline_points_[prevSplineIndex].y;
           const size_t numSplineKeys = splineIndex - prevSplineIndex;
           assert(numSplineKeys);
@@ -277,7 +513,7 @@ class Builder {
     // Finalize the costs.
     for (unsigned radix = 1; radix <= maxNumRadixBits; ++radix) {
       // Compute statistics.
-      const unsigned prevSplineIndex = radixAnalyzer[radix].prevSplineIndex;
+      const size_t prevSplineIndex = radixAnalyzer[radix].prevSplineIndex;
       const size_t numDataKeys = spline_points_.back().y - spline_points_[prevSplineIndex].y;
       const size_t numSplineKeys = spline_points_.size() - prevSplineIndex;
       assert(numSplineKeys);
@@ -299,35 +535,36 @@ class Builder {
   }
 
   void ComputeCHTStatistics(std::vector<Statistics>& statistics) {
-    // Compute the necessary amount of bits we need.
-    const unsigned lg = ComputeLog(max_key_ - min_key_, true);
-    const unsigned alreadyCommon = (sizeof(KeyType) << 3) - lg;
+    // Compute the necessary amount of bits we need (one more than the rounded
+    // logarithm if the range is a power of two).
+    const unsigned lg = ComputeLog(max_key_ - min_key_) + 1;
+    const unsigned alreadyCommon = (sizeof(Key) << 3) - lg;
 
     // Compute the longest common prefix.
-    const auto ExtractLCP = [&](unsigned index) -> unsigned {
+    const auto ExtractLCP = [&](size_t index) -> unsigned {
       return ComputeLcp(spline_points_[index].x - min_key_, spline_points_[index - 1].x - min_key_) - alreadyCommon;// __builtin_clzl((spline_points_[index].x - min_key_) ^ (spline_points_[index - 1].x - min_key_)) - alreadyCommon;
     };
 
     // Fill the lcp-array with lcp[i] := lcp(key[i], key[i - 1]).
     std::vector<unsigned> lcp(spline_points_.size());
-    std::vector<unsigned> counters(1 + lg);
+    std::vector<size_t> counters(1 + lg);
     lcp[0] = std::numeric_limits<unsigned>::max();
-    for (unsigned index = 1, limit = spline_points_.size(); index != limit; ++index) {
+    for (size_t index = 1, limit = spline_points_.size(); index != limit; ++index) {
       lcp[index] = ExtractLCP(index);
       counters[lcp[index]]++;
     }
 
     // Sort the lcp-array.
-    std::vector<unsigned> offsets(1 + lg);
+    std::vector<size_t> offsets(1 + lg);
     for (unsigned bit = 1; bit <= lg; ++bit)
       offsets[bit] = offsets[bit - 1] + counters[bit - 1];
-    std::vector<unsigned> sorted(spline_points_.size() - 1);
-    for (unsigned index = 1, limit = spline_points_.size(); index != limit; ++index)
+    std::vector<size_t> sorted(spline_points_.size() - 1);
+    for (size_t index = 1, limit = spline_points_.size(); index != limit; ++index)
       sorted[offsets[lcp[index]]++] = index;
 
     // Init the histogram. We only store the current row and the previous row,
     // as we do not need all others.
-    std::pair<unsigned, std::vector<Interval>> histogram[2];
+    std::pair<size_t, std::vector<Interval>> histogram[2];
     histogram[0].first = histogram[1].first = 0;
     histogram[0].second.resize(spline_points_.size());
     histogram[1].second.resize(spline_points_.size());
@@ -343,11 +580,11 @@ class Builder {
 
     // Init the first level of the histogram.
     AddNewInterval({1, spline_points_.size()});
-    unsigned ptrInSorted = 0;
+    size_t ptrInSorted = 0;
 
     const auto AnalyzeInterval = [&](unsigned level, Interval interval) -> void {
       // Check whether `pos` lies inside `interval`.
-      const auto isInside = [&](unsigned pos) -> bool {
+      const auto isInside = [&](size_t pos) -> bool {
         return (interval.first <= pos) && (pos < interval.second);
       };
 
@@ -379,7 +616,7 @@ class Builder {
     static constexpr unsigned maxPossibleTreeError = 1u << 10;
     const unsigned numPossibleBins = std::min(maxNumPossibleBins, lg);
     std::vector<unsigned> possibleNumBins(numPossibleBins);
-    std::vector<std::vector<std::pair<uint64_t, unsigned>>> matrix(numPossibleBins);
+    std::vector<std::vector<std::pair<uint64_t, uint64_t>>> matrix(numPossibleBins);
 
     // Set the possible number of bins and init the matrix which represents the prefix sums.
     for (unsigned index = 0; index != numPossibleBins; ++index) {
@@ -394,21 +631,21 @@ class Builder {
 
         // Does this number of bins benefit from this level?
         if (level % ComputeLog(currNumBins) == 0) {
-          for (unsigned ptr = 0, limit = histogram[side].first; ptr != limit; ++ptr) {
+          for (size_t ptr = 0, limit = histogram[side].first; ptr != limit; ++ptr) {
             auto interval = histogram[side].second[ptr];
             // [first, second[ also takes into consideration the `first-1`th element.
             // This is due to `lcp`-array, which takes the previous element into consideration.
             // That's why: `second` - `first` + 1.
             assert(interval.second > interval.first);
-            unsigned intervalSize = interval.second - interval.first + 1;
+            size_t intervalSize = interval.second - interval.first + 1;
             
             // Add the length of the interval to all deltas < `intervalSize.
-            matrix[index][std::min(intervalSize - 1, maxPossibleTreeError)].first += intervalSize;
+            matrix[index][std::min<size_t>(intervalSize - 1, maxPossibleTreeError)].first += intervalSize;
             
             // Does the interval breach the max error, i.e. > max error?
             // Then all deltas < `intervalSize` should receive a `+`.
             if (level != lg)
-              matrix[index][std::min(intervalSize - 1, maxPossibleTreeError)].second++;
+              matrix[index][std::min<size_t>(intervalSize - 1, maxPossibleTreeError)].second++;
           }
         }
       }
@@ -425,7 +662,7 @@ class Builder {
       histogram[side].first = 0;
 
       // And analyze the intervals.
-      for (unsigned index = 0, limit = histogram[1 - side].first; index != limit; ++index) {
+      for (size_t index = 0, limit = histogram[1 - side].first; index != limit; ++index) {
         AnalyzeInterval(level, histogram[1 - side].second[index]);
       }
 
@@ -465,7 +702,7 @@ class Builder {
     assert(!statistics.empty());
 
     // Find best cost under the given space limit.
-    const size_t space_limit = static_cast<size_t>(spline_points_.size()) * sizeof(Coord<KeyType>);
+    const size_t space_limit = static_cast<size_t>(spline_points_.size()) * sizeof(Coord<Key>);
     unsigned bestIndex = 0;
     for (unsigned index = 1, limit = statistics.size(); index != limit; ++index) {
       const auto elem = statistics[index];
@@ -478,23 +715,96 @@ class Builder {
     return statistics[bestIndex];
   }
 
-  const KeyType min_key_;
-  const KeyType max_key_;
+  // Version 2: the error profile and the errors of the spline segments.
+  // Version 3: measured errors of the spline segments.
+  // Version 4: the identity of the input.
+  static constexpr unsigned CheckpointVersion = 4;
+
+  // Saves and loads everything that changes while adding keys. The CHT
+  // builder has no state of its own until `Finalize`.
+  template <class Archive>
+  void SaveState(Archive& ar) const {
+    ar << curr_num_keys_;
+    ar << curr_num_distinct_keys_;
+    ar << prev_key_;
+    ar << prev_position_;
+    ar << upper_limit_.x << upper_limit_.y;
+    ar << lower_limit_.x << lower_limit_.y;
+    ar << prev_point_.x << prev_point_.y;
+    ar << spline_points_.size();
+    ar << boost::serialization::make_array(reinterpret_cast<const char*>(spline_points_.data()),
+                                           spline_points_.size() * sizeof(Coord<Key>));
+    ar << region_;
+    SaveVector(ar, segment_errors_);
+    SaveVector(ar, under_hull_);
+    SaveVector(ar, over_hull_);
+  }
+
+  template <class Archive>
+  void LoadState(Archive& ar) {
+    ar >> curr_num_keys_;
+    ar >> curr_num_distinct_keys_;
+    ar >> prev_key_;
+    ar >> prev_position_;
+    ar >> upper_limit_.x >> upper_limit_.y;
+    ar >> lower_limit_.x >> lower_limit_.y;
+    ar >> prev_point_.x >> prev_point_.y;
+    size_t num_spline_points;
+    ar >> num_spline_points;
+    spline_points_.resize(num_spline_points);
+    ar >> boost::serialization::make_array(reinterpret_cast<char*>(spline_points_.data()),
+                                           num_spline_points * sizeof(Coord<Key>));
+    ar >> region_;
+    LoadVector(ar, segment_errors_);
+    LoadVector(ar, under_hull_);
+    LoadVector(ar, over_hull_);
+  }
+
+  template <class Archive, class T>
+  static void SaveVector(Archive& ar, const std::vector<T>& vector) {
+    ar << vector.size();
+    ar << boost::serialization::make_array(reinterpret_cast<const char*>(vector.data()),
+                                           vector.size() * sizeof(T));
+  }
+
+  template <class Archive, class T>
+  static void LoadVector(Archive& ar, std::vector<T>& vector) {
+    size_t size;
+    ar >> size;
+    vector.resize(size);
+    ar >> boost::serialization::make_array(reinterpret_cast<char*>(vector.data()), size * sizeof(T));
+  }
+
+  const Key min_key_;
+  const Key max_key_;
   const size_t spline_max_error_;
-  std::vector<Coord<KeyType>> spline_points_;
+  std::vector<Coord<Key>> spline_points_;
+
+  // The error of each key, and whether it varies.
+  const ErrorProfile<KeyType> profile_;
+  const bool variable_error_;
+  // The region of the last key in `profile_`.
+  size_t region_ = 0;
+
+  // The measured (under, over) error of each spline segment, by its last
+  // point, and the hulls of the points after the last spline point (see
+  // `AddToHulls`).
+  std::vector<std::pair<size_t, size_t>> segment_errors_;
+  std::vector<Coord<Key>> under_hull_;
+  std::vector<Coord<Key>> over_hull_;
 
   size_t curr_num_keys_;
   size_t curr_num_distinct_keys_;
-  KeyType prev_key_;
+  Key prev_key_;
   size_t prev_position_;
-  ts_cht::Builder<KeyType> chtb_;
+  ts_cht::Builder<Key> chtb_;
 
   // Current upper and lower limits on the error corridor of the spline.
-  Coord<KeyType> upper_limit_;
-  Coord<KeyType> lower_limit_;
+  Coord<Key> upper_limit_;
+  Coord<Key> lower_limit_;
 
   // Previous CDF point.
-  Coord<KeyType> prev_point_;
+  Coord<Key> prev_point_;
 
   fs::path root_path_;
 };
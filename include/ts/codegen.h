@@ -0,0 +1,344 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <type_traits>
+
+#include <boost/serialization/level.hpp>
+
+#include "common.h"
+#include "key_traits.h"
+#include "ts.h"
+
+namespace ts {
+
+/* Lookups of a built spline, specialised at compile time */
+
+// A `TrieSpline` whose lookup is specialised on the parameters of one built
+// index, hard-coded in a header emitted by `CodeGenerator::EmitHeader` (see
+// `kv_codegen`): its key range, errors and CHT layout are constants, and so
+// is the CHT table, if small enough. It loads like a `TrieSpline`, from the
+// files of the index it was generated from, and can be the `Index` of the
+// maps in bench_utils.h. Loading any other index fails.
+//
+// `Params` is the struct of the emitted header.
+template <class Params>
+class GeneratedTrieSpline {
+ public:
+  using KeyType = typename Params::KeyType;
+  using Traits = KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+
+  GeneratedTrieSpline() = default;
+
+  GeneratedTrieSpline(fs::path root_path) : spline_(root_path) {}
+
+  // Maps the spline in place from `file`.
+  GeneratedTrieSpline(const mmap_struct::IndexFile& file) : spline_(file) { Check(); }
+
+  // Adds the sections of the spline to `writer`.
+  void AddSections(mmap_struct::IndexFile::Writer& writer) const { spline_.AddSections(writer); }
+
+  // Returns the estimated position of `key`.
+  double GetEstimatedPosition(const KeyType search_key) const {
+    size_t under, over;
+    return Estimate(Traits::Encode(search_key), under, over);
+  }
+
+  // Returns the same search bound as `TrieSpline::GetSearchBound`.
+  ts::SearchBound GetSearchBound(const KeyType key) const {
+    size_t under, over;
+    const size_t estimate = Estimate(Traits::Encode(key), under, over);
+    const size_t begin = (estimate < over) ? 0 : (estimate - over);
+    // `end` is exclusive.
+    const size_t end =
+        (estimate + under + 2 > Params::NumKeys) ? Params::NumKeys : (estimate + under + 2);
+    return ts::SearchBound{begin, end};
+  }
+
+  // Returns the number of indexed keys.
+  size_t GetNumKeys() const { return Params::NumKeys; }
+
+  // Returns the size in bytes.
+  size_t GetSize() const { return spline_.GetSize(); }
+
+  // Returns the generic spline, which looks up the same bounds.
+  const TrieSpline<KeyType>& GetSpline() const { return spline_; }
+
+  // Returns the number of keys whose estimate or search bound differ from
+  // the generic spline's, out of the keys of the spline points, their
+  // neighbours, and `num_probes` random keys of the key range.
+  size_t CrossCheck(size_t num_probes) const {
+    size_t num_mismatches = 0;
+    const auto Probe = [&](const Key key) {
+      const KeyType search_key = Traits::Decode(key);
+      const ts::SearchBound bound = GetSearchBound(search_key);
+      const ts::SearchBound expected = spline_.GetSearchBound(search_key);
+      if (bound.begin != expected.begin || bound.end != expected.end ||
+          GetEstimatedPosition(search_key) != spline_.GetEstimatedPosition(search_key)) {
+        ++num_mismatches;
+      }
+    };
+    const Coord<Key>* points = spline_.spline_points_.data();
+    for (size_t idx = 0; idx < spline_.spline_points_.size(); ++idx) {
+      Probe(points[idx].x);
+      if (points[idx].x > 0) Probe(points[idx].x - 1);
+      if (points[idx].x < std::numeric_limits<Key>::max()) Probe(points[idx].x + 1);
+    }
+    std::mt19937_64 gen(42);
+    const Key range = Params::MaxKey - Params::MinKey;
+    for (size_t probe = 0; probe < num_probes; ++probe) {
+      Key offset = static_cast<Key>(gen());
+      if constexpr (sizeof(Key) > sizeof(uint64_t)) offset = (offset << 64) | gen();
+      if (range < std::numeric_limits<Key>::max()) offset %= range + 1;
+      Probe(Params::MinKey + offset);
+    }
+    return num_mismatches;
+  }
+
+ private:
+  static_assert(std::is_same<typename Params::Entry, unsigned>::value ||
+                    std::is_same<typename Params::Entry, uint64_t>::value,
+                "GeneratedTrieSpline: CHT entries are 32 or 64 bits");
+
+  using Entry = typename Params::Entry;
+  using CHT = ts_cht::CompactHistTree<Key>;
+
+  // As `TrieSpline::Estimate`.
+  double Estimate(const Key key, size_t& under, size_t& over) const {
+    under = over = Params::SplineMaxError;
+    // Truncate to data boundaries.
+    if (key <= Params::MinKey) return 0;
+    if (key > Params::MaxKey) return Params::NumKeys - 1;
+    const Coord<Key>* points = spline_.spline_points_.data();
+    // The first occurrence of `MaxKey`, which may be duplicated.
+    if (key == Params::MaxKey) return points[Params::NumSplinePoints - 1].y;
+
+    // Find spline segment with `key` ∈ (spline[index - 1], spline[index]].
+    const size_t index = GetSplineSegment(key, points);
+    const ts::SegmentBound bound = spline_.segment_bounds_.data()[index];
+    under = static_cast<size_t>(bound.under) << Params::BoundShift;
+    over = static_cast<size_t>(bound.over) << Params::BoundShift;
+    const Coord<Key> down = points[index - 1];
+    const Coord<Key> up = points[index];
+
+#ifdef PLEX_FIXED_POINT_SPLINE
+    if constexpr (sizeof(Key) <= sizeof(uint64_t)) {
+      under += ts::FixedSlope::UnderSlack;
+      over += ts::FixedSlope::OverSlack;
+      return static_cast<size_t>(down.y) + spline_.fixed_slopes_[index].Interpolate(key - down.x);
+    }
+#endif
+
+    // Compute slope.
+    const double x_diff = up.x - down.x;
+    const double y_diff = up.y - down.y;
+    const double slope = y_diff / x_diff;
+
+    // Interpolate.
+    const double key_diff = key - down.x;
+    return std::fma(key_diff, slope, down.y);
+  }
+
+  // As `TrieSpline::GetSplineSegment`.
+  size_t GetSplineSegment(const Key key, const Coord<Key>* points) const {
+    // Narrow search range using CHT.
+    const ts_cht::SearchBound range = GetCHTSearchBound(key);
+
+    // Linear search?
+    if (range.end - range.begin < 32) {
+      // Do linear search over narrowed range.
+      size_t current = range.begin;
+      while (points[current].x < key) ++current;
+      return current;
+    }
+
+    // Do binary search over narrowed range.
+    const auto lb = std::lower_bound(points + range.begin, points + range.end, key,
+                                     [](const Coord<Key>& coord, const Key key) {
+                                       return coord.x < key;
+                                     });
+    return std::distance(points, lb);
+  }
+
+  // As `CompactHistTree::GetSearchBound`, on the encoded `key`.
+  ts_cht::SearchBound GetCHTSearchBound(const Key key) const {
+    const Entry* table = GetTable();
+    if constexpr (Params::SingleLayer) {
+      const Key prefix = (key - Params::MinKey) >> Params::Shift;
+      return ts_cht::SearchBound{table[prefix], table[prefix + 1]};
+    } else if constexpr (std::is_same<Entry, uint64_t>::value) {
+      return spline_.cht_.GetSearchBound(key);
+    } else {
+      using Lookup = typename CHT::template TreeLookup<Params::LogNumBins>;
+      const unsigned entry = Lookup::template Descend<0>(
+          table, ((key - Params::MinKey) >> Params::KeyDrop) << Params::KeyShift, 0);
+      const size_t begin = __builtin_expect(entry & Lookup::Entry::Leaf, 1)
+                               ? (entry & Lookup::Entry::Mask)
+                               : spline_.cht_.Lookup(key, table);
+      // `end` is exclusive.
+      const size_t end = (begin + Params::TreeMaxError + 1 > Params::NumSplinePoints)
+                            ? Params::NumSplinePoints
+                            : (begin + Params::TreeMaxError + 1);
+      return ts_cht::SearchBound{begin, end};
+    }
+  }
+
+  const Entry* GetTable() const {
+    if constexpr (Params::EmbeddedTable) {
+      return Params::Table;
+    } else {
+      return spline_.cht_.template GetTable<Entry>();
+    }
+  }
+
+  // Exits if the loaded spline is not the one `Params` were generated from.
+  void Check() const {
+    const CHT& cht = spline_.cht_;
+    const auto Require = [](bool matches, const char* what) {
+      if (matches) return;
+      std::cerr << "GeneratedTrieSpline: the loaded index has another " << what
+                << " than the one the lookup was generated from" << std::endl;
+      exit(EXIT_FAILURE);
+    };
+    Require(spline_.min_key_ == Params::MinKey && spline_.max_key_ == Params::MaxKey, "key range");
+    Require(spline_.num_keys_ == Params::NumKeys, "number of keys");
+    Require(spline_.spline_max_error_ == Params::SplineMaxError &&
+                spline_.bound_shift_ == Params::BoundShift,
+            "spline error");
+    Require(spline_.spline_points_.size() == Params::NumSplinePoints &&
+                spline_.segment_bounds_.size() == Params::NumSplinePoints,
+            "number of spline points");
+    Require(cht.single_layer_ == Params::SingleLayer &&
+                cht.wide_ == std::is_same<Entry, uint64_t>::value &&
+                cht.log_num_bins_ == Params::LogNumBins && cht.shift_ == Params::Shift &&
+                cht.key_drop_ == Params::KeyDrop && cht.key_shift_ == Params::KeyShift &&
+                cht.max_error_ == Params::TreeMaxError && cht.num_keys_ == Params::NumSplinePoints &&
+                cht.table_size_ == Params::TableSize,
+            "CHT layout");
+    if constexpr (Params::EmbeddedTable) {
+      const Entry* table = cht.template GetTable<Entry>();
+      Require(std::equal(table, table + Params::TableSize, Params::Table), "CHT table");
+    }
+  }
+
+  TrieSpline<KeyType> spline_;
+
+  /* Serialization */
+
+  // Serialized as the spline itself (see the implementation level below), so
+  // that it loads the archives of a `TrieSpline`.
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive & ar, const unsigned int version __attribute__((unused))) {
+    ar & this->spline_;
+    if (Archive::is_loading::value) Check();
+  }
+};
+
+// Emits the header of a `GeneratedTrieSpline` for a built `TrieSpline`.
+template <class KeyType>
+class CodeGenerator {
+ public:
+  using Traits = KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+
+  // Writes a header to `out` that defines `name_space::name` as the
+  // `GeneratedTrieSpline` of `spline`, with its CHT table embedded if it has
+  // at most `max_table_entries` entries.
+  static void EmitHeader(const TrieSpline<KeyType>& spline, const std::string& name_space,
+                         const std::string& name, size_t max_table_entries, std::ostream& out) {
+    const ts_cht::CompactHistTree<Key>& cht = spline.cht_;
+    const bool embedded = cht.table_size_ <= max_table_entries;
+    out << "#pragma once\n\n"
+        << "// Generated by kv_codegen; regenerate whenever the index is rebuilt.\n\n"
+        << "#include <cstddef>\n"
+        << "#include <cstdint>\n\n"
+        << "#include \"ts/codegen.h\"\n\n"
+        << "namespace " << name_space << " {\n\n"
+        << "struct " << name << "Params {\n"
+        << "  using KeyType = " << TypeName<KeyType>() << ";\n"
+        << "  using Key = ts::KeyTraits<KeyType>::Unsigned;\n"
+        << "  using Entry = " << (cht.wide_ ? "uint64_t" : "unsigned") << ";\n\n"
+        << "  // Spline\n"
+        << "  static constexpr Key MinKey = " << KeyLiteral(spline.min_key_) << ";\n"
+        << "  static constexpr Key MaxKey = " << KeyLiteral(spline.max_key_) << ";\n"
+        << "  static constexpr size_t NumKeys = " << spline.num_keys_ << ";\n"
+        << "  static constexpr size_t SplineMaxError = " << spline.spline_max_error_ << ";\n"
+        << "  static constexpr unsigned BoundShift = " << spline.bound_shift_ << ";\n"
+        << "  static constexpr size_t NumSplinePoints = " << spline.spline_points_.size() << ";\n\n"
+        << "  // CHT\n"
+        << "  static constexpr bool SingleLayer = " << (cht.single_layer_ ? "true" : "false") << ";\n"
+        << "  static constexpr unsigned LogNumBins = " << cht.log_num_bins_ << ";\n"
+        << "  static constexpr unsigned Shift = " << cht.shift_ << ";\n"
+        << "  static constexpr unsigned KeyDrop = " << cht.key_drop_ << ";\n"
+        << "  static constexpr unsigned KeyShift = " << cht.key_shift_ << ";\n"
+        << "  static constexpr size_t TreeMaxError = " << cht.max_error_ << ";\n"
+        << "  static constexpr size_t TableSize = " << cht.table_size_ << ";\n"
+        << "  static constexpr bool EmbeddedTable = " << (embedded ? "true" : "false") << ";\n";
+    if (embedded) {
+      out << "  static constexpr Entry Table[] = {";
+      for (size_t idx = 0; idx < cht.table_size_; ++idx) {
+        out << ((idx % 8 == 0) ? "\n      " : " ");
+        if (cht.wide_) {
+          out << "UINT64_C(" << cht.wide_table_data_[idx] << "),";
+        } else {
+          out << cht.table_data_[idx] << "u,";
+        }
+      }
+      out << "\n  };\n";
+    }
+    out << "};\n\n"
+        << "using " << name << " = ts::GeneratedTrieSpline<" << name << "Params>;\n\n"
+        << "}  // namespace " << name_space << "\n";
+  }
+
+  // Returns the name of `T` in a header.
+  template <class T>
+  static std::string TypeName() {
+    if constexpr (std::is_same<T, uint8_t>::value) return "uint8_t";
+    else if constexpr (std::is_same<T, uint16_t>::value) return "uint16_t";
+    else if constexpr (std::is_same<T, uint32_t>::value) return "uint32_t";
+    else if constexpr (std::is_same<T, uint64_t>::value) return "uint64_t";
+    else if constexpr (std::is_same<T, __uint128_t>::value) return "__uint128_t";
+    else if constexpr (std::is_same<T, int8_t>::value) return "int8_t";
+    else if constexpr (std::is_same<T, int16_t>::value) return "int16_t";
+    else if constexpr (std::is_same<T, int32_t>::value) return "int32_t";
+    else if constexpr (std::is_same<T, int64_t>::value) return "int64_t";
+    else if constexpr (std::is_same<T, __int128_t>::value) return "__int128_t";
+    else if constexpr (std::is_same<T, float>::value) return "float";
+    else if constexpr (std::is_same<T, double>::value) return "double";
+    else static_assert(sizeof(T) == 0, "CodeGenerator: unsupported type");
+  }
+
+ private:
+  // Returns the encoded `key` as a constant expression.
+  static std::string KeyLiteral(const Key key) {
+    if constexpr (sizeof(Key) > sizeof(uint64_t)) {
+      return "(Key(UINT64_C(" + std::to_string(static_cast<uint64_t>(key >> 64)) +
+             ")) << 64 | UINT64_C(" + std::to_string(static_cast<uint64_t>(key)) + "))";
+    } else {
+      return "Key(UINT64_C(" + std::to_string(static_cast<uint64_t>(key)) + "))";
+    }
+  }
+};
+
+}  // namespace ts
+
+// Serialize a `GeneratedTrieSpline` without class information of its own.
+namespace boost {
+namespace serialization {
+
+template <class Params>
+struct implementation_level<ts::GeneratedTrieSpline<Params>> {
+  typedef mpl::integral_c_tag tag;
+  typedef mpl::int_<object_serializable> type;
+  BOOST_STATIC_CONSTANT(int, value = object_serializable);
+};
+
+}  // namespace serialization
+}  // namespace boost
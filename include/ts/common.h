@@ -1,7 +1,11 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
 
 namespace ts {
 
@@ -17,11 +21,93 @@ struct SearchBound {
   size_t end;  // Exclusive.
 };
 
+// The measured errors of a spline segment: positions are at most `under`
+// above and `over` below their estimates, in units of a per-spline power of
+// two.
+struct SegmentBound {
+  uint16_t under;
+  uint16_t over;
+};
+
+// Packs the (under, over) `errors` into `SegmentBound`s, with the smallest
+// `shift` to fit them, rounding up.
+inline std::vector<SegmentBound> PackSegmentBounds(
+    const std::vector<std::pair<size_t, size_t>>& errors, unsigned& shift) {
+  size_t max_error = 0;
+  for (const auto& error : errors) max_error = std::max({max_error, error.first, error.second});
+  shift = 0;
+  while ((max_error >> shift) > std::numeric_limits<uint16_t>::max() - 1) ++shift;
+  const auto Pack = [&](size_t error) {
+    return static_cast<uint16_t>((error + (size_t(1) << shift) - 1) >> shift);
+  };
+  std::vector<SegmentBound> bounds(errors.size());
+  for (size_t idx = 0; idx < errors.size(); ++idx) {
+    bounds[idx] = {Pack(errors[idx].first), Pack(errors[idx].second)};
+  }
+  return bounds;
+}
+
+// The slope of a spline segment in fixed point, with a `Word` each for its
+// whole and fractional part, rounded down, to interpolate with integer
+// multiplies instead of a floating-point division (with
+// PLEX_FIXED_POINT_SPLINE). `Wide` holds two `Word`s. Keys and positions fit
+// in a `Word`.
+template <class Word, class Wide>
+struct BasicFixedSlope {
+  static constexpr unsigned FractionBits = 8 * sizeof(Word);
+
+  // Fixed-point estimates are at most `UnderSlack` positions below the
+  // floating-point ones that segment errors are measured on, and at most
+  // `OverSlack` above: they are at most one below the exact interpolation,
+  // which doubles are within a position of, for fewer than 2^50 keys.
+  static constexpr size_t UnderSlack = 2;
+  static constexpr size_t OverSlack = 1;
+
+  BasicFixedSlope() = default;
+
+  // The slope `y_diff` / `x_diff`, with `x_diff` > 0.
+  BasicFixedSlope(const Word x_diff, const Word y_diff)
+      : whole(y_diff / x_diff),
+        fraction(static_cast<Word>((static_cast<Wide>(y_diff % x_diff) << FractionBits) / x_diff)) {}
+
+  // Returns `key_diff` * slope, rounded down, for `key_diff` at most the
+  // `x_diff` of the segment.
+  Word Interpolate(const Word key_diff) const {
+    return key_diff * whole +
+           static_cast<Word>((static_cast<Wide>(key_diff) * fraction) >> FractionBits);
+  }
+
+  Word whole;
+  Word fraction;
+};
+
+// A 64.64 slope, for keys of up to 64 bits.
+using FixedSlope = BasicFixedSlope<uint64_t, unsigned __int128>;
+// A 32.32 slope, for 32-bit keys and fewer than 2^32 positions.
+using FixedSlope32 = BasicFixedSlope<uint32_t, uint64_t>;
+
+// An estimated count of keys, with guaranteed bounds: the true count is in
+// [min, max].
+struct CountBound {
+  double estimate;
+  size_t min;
+  size_t max;
+};
+
+// Returns the count of keys in [lo, hi) from the ranks `lo` and `hi` of its
+// ends (see `TrieSpline::EstimateRank`).
+inline CountBound CountBetween(const CountBound& lo, const CountBound& hi) {
+  const size_t min = hi.min > lo.max ? hi.min - lo.max : 0;
+  const size_t max = hi.max > lo.min ? hi.max - lo.min : 0;
+  const double estimate = std::min<double>(std::max<double>(hi.estimate - lo.estimate, min), max);
+  return CountBound{estimate, min, max};
+}
+
 // A radix config.
 struct RadixConfig {
 	unsigned shiftBits;
 	unsigned prevPrefix;
-	unsigned prevSplineIndex;
+	size_t prevSplineIndex;
 	double cost;
 };
 
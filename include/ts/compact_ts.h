@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <boost/serialization/array_wrapper.hpp>
+
+#include "ts_cht/packed_cht.h"
+#include "bit_packing.h"
+#include "common.h"
+#include "ts.h"
+
+namespace ts {
+
+// A compact encoding of a built `TrieSpline`. Spline keys and positions are
+// stored as `bit_packing::AnchoredArray`s (positions are integer ranks), and
+// the CHT as a `ts_cht::PackedHistTree`. The measured errors of the spline
+// segments are kept as is. Lookups decode single entries in place.
+template <class KeyType>
+class CompactTrieSpline {
+ public:
+  using Traits = KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+  static_assert(sizeof(Key) <= sizeof(uint64_t), "CompactTrieSpline: keys wider than 64 bits");
+
+  CompactTrieSpline() = default;
+
+  CompactTrieSpline(fs::path root_path __attribute__((unused))) {}
+
+  explicit CompactTrieSpline(const TrieSpline<KeyType>& ts)
+      : min_key_(ts.min_key_),
+        max_key_(ts.max_key_),
+        num_keys_(ts.num_keys_),
+        spline_max_error_(ts.spline_max_error_),
+        xs_(ts.spline_points_.size(),
+            [&](size_t idx) { return ts.spline_points_[idx].x; }),
+        ys_(ts.spline_points_.size(),
+            [&](size_t idx) {
+              assert(ts.spline_points_[idx].y == std::floor(ts.spline_points_[idx].y));
+              return static_cast<uint64_t>(ts.spline_points_[idx].y);
+            }),
+        bounds_(ts.segment_bounds_.data(), ts.segment_bounds_.data() + ts.segment_bounds_.size()),
+        bound_shift_(ts.bound_shift_),
+        cht_(ts.cht_) {}
+
+  // Returns the estimated position of `key`.
+  double GetEstimatedPosition(const KeyType search_key) const {
+    size_t under, over;
+    return Estimate(Traits::Encode(search_key), under, over);
+  }
+
+  // Returns a search bound [begin, end) around the estimated position, from
+  // the measured errors of the spline segment of `key`.
+  ts::SearchBound GetSearchBound(const KeyType key) const {
+    size_t under, over;
+    const size_t estimate = Estimate(Traits::Encode(key), under, over);
+    const size_t begin = (estimate < over) ? 0 : (estimate - over);
+    // `end` is exclusive.
+    const size_t end = (estimate + under + 2 > num_keys_) ? num_keys_ : (estimate + under + 2);
+    return ts::SearchBound{begin, end};
+  }
+
+  /* Estimates on the index alone, see `TrieSpline` */
+
+  ts::CountBound EstimateRank(const KeyType search_key) const {
+    const Key key = Traits::Encode(search_key);
+    if (key <= min_key_) return ts::CountBound{0, 0, 0};
+    if (key > max_key_) return ts::CountBound{double(num_keys_), num_keys_, num_keys_};
+    const double estimate = GetEstimatedPosition(search_key);
+    const ts::SearchBound bound = GetSearchBound(search_key);
+    return ts::CountBound{std::min<double>(std::max<double>(estimate, bound.begin), bound.end),
+                          bound.begin, bound.end};
+  }
+
+  ts::CountBound EstimateRangeCount(const KeyType lo, const KeyType hi) const {
+    if (!(lo < hi)) return ts::CountBound{0, 0, 0};
+    return ts::CountBetween(EstimateRank(lo), EstimateRank(hi));
+  }
+
+  std::vector<ts::CountBound> EstimateHistogram(const std::vector<KeyType>& boundaries) const {
+    std::vector<ts::CountBound> buckets;
+    if (boundaries.empty()) return buckets;
+    buckets.reserve(boundaries.size() - 1);
+    ts::CountBound prev = EstimateRank(boundaries.front());
+    for (size_t idx = 1; idx < boundaries.size(); ++idx) {
+      assert(!(boundaries[idx] < boundaries[idx - 1]));
+      const ts::CountBound next = EstimateRank(boundaries[idx]);
+      buckets.push_back(ts::CountBetween(prev, next));
+      prev = next;
+    }
+    return buckets;
+  }
+
+  KeyType EstimateQuantile(const double q) const {
+    const double target = std::min(std::max(q, 0.0), 1.0) * (num_keys_ - 1);
+
+    // Find spline segment with `target` ∈ (spline[index - 1].y, spline[index].y].
+    size_t index = 0;
+    size_t count = ys_.size();
+    while (count > 0) {
+      const size_t half = count / 2;
+      if (ys_[index + half] < target) {
+        index += half + 1;
+        count -= half + 1;
+      } else {
+        count = half;
+      }
+    }
+    if (index == 0) return Traits::Decode(min_key_);
+    if (index == ys_.size()) return Traits::Decode(max_key_);
+    const Key down_x = xs_[index - 1];
+    const double down_y = ys_[index - 1];
+
+    // Interpolate.
+    const Key x_diff = xs_[index] - down_x;
+    const double offset = (target - down_y) / (ys_[index] - down_y) * static_cast<double>(x_diff);
+    return Traits::Decode(down_x + std::min<Key>(static_cast<Key>(offset), x_diff));
+  }
+
+  // Returns the number of indexed keys.
+  size_t GetNumKeys() const { return num_keys_; }
+
+  // Returns the size in bytes.
+  size_t GetSize() const {
+    return sizeof(*this) + xs_.GetSize() + ys_.GetSize() +
+           bounds_.size() * sizeof(ts::SegmentBound) + cht_.GetSize();
+  }
+
+ private:
+  // Returns the estimated position of the encoded `key`, and sets `under` and
+  // `over` to the largest errors of the estimate either way.
+  double Estimate(const Key key, size_t& under, size_t& over) const {
+    under = over = spline_max_error_;
+    // Truncate to data boundaries.
+    if (key <= min_key_) return 0;
+    if (key > max_key_) return num_keys_ - 1;
+    // The first occurrence of `max_key_`, which may be duplicated.
+    if (key == max_key_) return ys_[ys_.size() - 1];
+
+    // Find spline segment with `key` ∈ (spline[index - 1], spline[index]].
+    const size_t index = GetSplineSegment(key);
+    under = static_cast<size_t>(bounds_[index].under) << bound_shift_;
+    over = static_cast<size_t>(bounds_[index].over) << bound_shift_;
+    const Key down_x = xs_[index - 1];
+    const double down_y = ys_[index - 1];
+
+    // Compute slope.
+    const double x_diff = xs_[index] - down_x;
+    const double y_diff = ys_[index] - down_y;
+    const double slope = y_diff / x_diff;
+
+    // Interpolate.
+    const double key_diff = key - down_x;
+    return std::fma(key_diff, slope, down_y);
+  }
+
+  // Returns the index of the spline point that marks the end of the spline
+  // segment that contains the `key`: `key` ∈ (spline[index - 1], spline[index]]
+  size_t GetSplineSegment(const Key key) const {
+    // Narrow search range using CHT.
+    const auto range = cht_.GetSearchBound(key);
+
+    // Linear search?
+    if (range.end - range.begin < 32) {
+      // Do linear search over narrowed range.
+      size_t current = range.begin;
+      while (xs_[current] < key) ++current;
+      return current;
+    }
+
+    // Do binary search over narrowed range.
+    size_t lo = range.begin;
+    size_t count = range.end - range.begin;
+    while (count > 0) {
+      const size_t half = count / 2;
+      if (xs_[lo + half] < key) {
+        lo += half + 1;
+        count -= half + 1;
+      } else {
+        count = half;
+      }
+    }
+    return lo;
+  }
+
+  Key min_key_;
+  Key max_key_;
+  size_t num_keys_;
+  size_t spline_max_error_;
+
+  bit_packing::AnchoredArray<Key> xs_;
+  bit_packing::AnchoredArray<uint64_t> ys_;
+  std::vector<ts::SegmentBound> bounds_;
+  unsigned bound_shift_;
+  ts_cht::PackedHistTree<Key> cht_;
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive & ar, const unsigned int version __attribute__((unused))) {
+    ar & this->min_key_;
+    ar & this->max_key_;
+    ar & this->num_keys_;
+    ar & this->spline_max_error_;
+    ar & this->xs_;
+    ar & this->ys_;
+    this->bounds_.resize(this->xs_.size());
+    ar & boost::serialization::make_array(reinterpret_cast<char*>(this->bounds_.data()),
+                                          this->bounds_.size() * sizeof(ts::SegmentBound));
+    ar & this->bound_shift_;
+    ar & this->cht_;
+  }
+};
+
+}  // namespace ts
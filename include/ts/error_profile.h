@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "key_traits.h"
+
+namespace ts {
+
+/* ErrorProfile: per-region spline errors, shaped by a query workload */
+
+// Splits the key space into regions, each with the error its keys are
+// indexed with. See `Builder::ProfileErrors` to fit one to a query sample.
+template <class KeyType>
+class ErrorProfile {
+ public:
+  using Traits = KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+
+  ErrorProfile() : ErrorProfile(0) {}
+
+  // A uniform profile.
+  explicit ErrorProfile(size_t spline_max_error) : errors_{spline_max_error} {}
+
+  // Region r is [boundaries[r - 1], boundaries[r]) of the encoded keys, with
+  // open ends, and has `errors[r]`.
+  ErrorProfile(std::vector<Key> boundaries, std::vector<size_t> errors)
+      : boundaries_(std::move(boundaries)), errors_(std::move(errors)) {
+    assert(errors_.size() == boundaries_.size() + 1);
+    assert(std::is_sorted(boundaries_.begin(), boundaries_.end()));
+  }
+
+  // Returns whether all keys have the same error.
+  bool IsUniform() const {
+    return std::all_of(errors_.begin(), errors_.end(),
+                       [&](size_t error) { return error == errors_.front(); });
+  }
+
+  // Returns the error of the encoded `key`.
+  size_t GetError(const Key key) const { return errors_[GetRegion(key)]; }
+
+  // Returns the error of the encoded `key`, starting the search at `region`,
+  // which must not be past the region of `key`. Sets `region` to the region of
+  // `key`, so that increasing keys are looked up in a single pass.
+  size_t GetError(const Key key, size_t& region) const {
+    while (region < boundaries_.size() && key >= boundaries_[region]) ++region;
+    return errors_[region];
+  }
+
+  size_t GetMaxError() const { return *std::max_element(errors_.begin(), errors_.end()); }
+
+  size_t GetNumRegions() const { return errors_.size(); }
+
+  const std::vector<Key>& GetBoundaries() const { return boundaries_; }
+  const std::vector<size_t>& GetErrors() const { return errors_; }
+
+  // Returns the region of the encoded `key`.
+  size_t GetRegion(const Key key) const {
+    return std::upper_bound(boundaries_.begin(), boundaries_.end(), key) - boundaries_.begin();
+  }
+
+ private:
+  std::vector<Key> boundaries_;
+  std::vector<size_t> errors_;
+};
+
+}  // namespace ts
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mmap_struct.h"
+
+namespace mmap_struct {
+
+/* IndexFile: single-file, versioned, mmap-ed container of index sections */
+
+// Layout: a fixed `Header`, then `num_sections` `SectionEntry`s, then the
+// sections themselves, each starting at a multiple of `Alignment`. Opening a
+// file maps it once; sections are used in place without any deserialization.
+class IndexFile {
+ public:
+  static constexpr char Magic[8] = {'P', 'L', 'E', 'X', 'I', 'D', 'X', '\0'};
+  static constexpr uint32_t Version = 1;
+  static constexpr size_t Alignment = 64;
+
+  // Section kinds.
+  enum Kind : uint32_t {
+    TrieSplineMeta = 1,
+    CHTMeta = 2,
+    CHTTable = 3,
+    SplinePoints = 4,
+    Data = 5,
+    SegmentBounds = 6,
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_sections;
+    uint64_t file_size;
+  };
+
+  struct SectionEntry {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t checksum;
+  };
+
+  // Collects sections and writes them into a single file.
+  class Writer {
+   public:
+    // Adds a section that points to `data`, which must outlive `Write`.
+    void Add(Kind kind, const void* data, size_t size) {
+      sections_.push_back({kind, data, size, std::string()});
+    }
+
+    // Adds a section that holds a copy of the trivially copyable `value`.
+    template <class T>
+    void AddValue(Kind kind, const T& value) {
+      sections_.push_back({kind, nullptr, sizeof(T),
+                           std::string(reinterpret_cast<const char*>(&value), sizeof(T))});
+    }
+
+    void Write(fs::path filepath) const {
+      // Lay out the sections.
+      std::vector<SectionEntry> entries;
+      size_t offset = AlignUp(sizeof(Header) + sections_.size() * sizeof(SectionEntry));
+      for (const auto& section : sections_) {
+        const char* data = section.bytes();
+        entries.push_back({section.kind, 0, offset, section.size, Checksum(data, section.size)});
+        offset = AlignUp(offset + section.size);
+      }
+
+      Header header;
+      memcpy(header.magic, Magic, sizeof(Magic));
+      header.version = Version;
+      header.num_sections = sections_.size();
+      header.file_size = offset;
+
+      std::ofstream out(filepath, std::ios::binary | std::ios::trunc);
+      if (!out.is_open()) {
+        std::cerr << "Error write-opening " << filepath << std::endl;
+        exit(1);
+      }
+      out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+      out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(SectionEntry));
+      size_t written = sizeof(Header) + entries.size() * sizeof(SectionEntry);
+      const std::string padding(Alignment, '\0');
+      for (size_t idx = 0; idx < sections_.size(); ++idx) {
+        out.write(padding.data(), entries[idx].offset - written);
+        out.write(sections_[idx].bytes(), sections_[idx].size);
+        written = entries[idx].offset + sections_[idx].size;
+      }
+      out.write(padding.data(), header.file_size - written);
+      out.close();
+      if (out.fail()) {
+        std::cerr << "Error writing " << filepath << std::endl;
+        exit(1);
+      }
+      std::cout << "Written index file " << filepath << " with size " << header.file_size << " bytes" << std::endl;
+    }
+
+   private:
+    struct Section {
+      Kind kind;
+      const void* data;
+      size_t size;
+      std::string owned;
+
+      const char* bytes() const {
+        return data ? reinterpret_cast<const char*>(data) : owned.data();
+      }
+    };
+
+    std::vector<Section> sections_;
+  };
+
+  IndexFile(fs::path filepath) {  // Open and map an existing file
+    const char* filename = filepath.c_str();
+
+    // open file
+    fd_ = open(filename, O_RDONLY);
+    if (fd_ < 0) {
+      std::cerr << "Error read-opening " << filename << std::endl;
+      exit(1);
+    }
+
+    // get file size for mapping
+    struct stat sb;
+    if (fstat(fd_, &sb) == -1) {
+      std::cerr << "Error obtaining fstat" << std::endl;
+      exit(1);
+    }
+    file_size_ = sb.st_size;
+
+    // mmap
+    addr_ = mmap(NULL, file_size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (addr_ == MAP_FAILED) {
+      std::cerr << "Error mmap index file" << std::endl;
+      exit(1);
+    }
+
+    // Validate the header.
+    const Header* header = reinterpret_cast<const Header*>(addr_);
+    if (file_size_ < sizeof(Header) || memcmp(header->magic, Magic, sizeof(Magic)) != 0) {
+      std::cerr << "Error: " << filepath << " is not a PLEX index file" << std::endl;
+      exit(1);
+    }
+    if (header->version != Version) {
+      std::cerr << "Error: " << filepath << " has version " << header->version
+                << ", expected " << Version << std::endl;
+      exit(1);
+    }
+    if (header->file_size != file_size_ ||
+        sizeof(Header) + header->num_sections * sizeof(SectionEntry) > file_size_) {
+      std::cerr << "Error: " << filepath << " is truncated" << std::endl;
+      exit(1);
+    }
+    num_sections_ = header->num_sections;
+    entries_ = reinterpret_cast<const SectionEntry*>(header + 1);
+    // Validate the sections, so that `Get` never reads past the file.
+    for (size_t idx = 0; idx < num_sections_; ++idx) {
+      const SectionEntry& entry = entries_[idx];
+      if (entry.offset > file_size_ || entry.size > file_size_ - entry.offset) {
+        std::cerr << "Error: " << filepath << " has section " << entry.kind
+                  << " out of bounds" << std::endl;
+        exit(1);
+      }
+    }
+    std::cout << "Mmap-ed index file " << filepath << " with size " << file_size_ << " bytes, at " << addr_ << std::endl;
+  }
+
+  IndexFile(const IndexFile& other) = delete;
+  IndexFile& operator=(const IndexFile& other) = delete;
+
+  ~IndexFile() {
+    if (addr_ != NULL) munmap(addr_, file_size_);
+    if (fd_ != -1) close(fd_);
+  }
+
+  // Returns a pointer to the section of `kind`, and its size in bytes.
+  const void* Get(Kind kind, size_t* size = nullptr) const {
+    const SectionEntry& entry = Find(kind);
+    if (size) *size = entry.size;
+    return reinterpret_cast<const char*>(addr_) + entry.offset;
+  }
+
+  // Returns the section of `kind` as an array of `T`.
+  template <class T>
+  const T* GetArray(Kind kind, size_t* count) const {
+    size_t size;
+    const void* data = Get(kind, &size);
+    assert(size % sizeof(T) == 0);
+    *count = size / sizeof(T);
+    return reinterpret_cast<const T*>(data);
+  }
+
+  // Returns the section of `kind` as a single `T`.
+  template <class T>
+  const T& GetValue(Kind kind) const {
+    size_t size;
+    const void* data = Get(kind, &size);
+    if (size != sizeof(T)) {
+      std::cerr << "Error: index file section " << kind << " has unexpected size " << size << std::endl;
+      exit(1);
+    }
+    return *reinterpret_cast<const T*>(data);
+  }
+
+  // Verifies all section checksums. This touches every page of the file, so
+  // it is not done on open.
+  bool VerifyChecksums() const {
+    for (size_t idx = 0; idx < num_sections_; ++idx) {
+      const SectionEntry& entry = entries_[idx];
+      const char* data = reinterpret_cast<const char*>(addr_) + entry.offset;
+      if (Checksum(data, entry.size) != entry.checksum) {
+        std::cerr << "Checksum mismatch in index file section " << entry.kind << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // A fast 64-bit checksum, processing 8 bytes per step.
+  static uint64_t Checksum(const void* data, size_t size) {
+    static constexpr uint64_t Prime = 0x9E3779B97F4A7C15ull;
+    const char* bytes = reinterpret_cast<const char*>(data);
+    uint64_t hash = size * Prime;
+    size_t idx = 0;
+    for (; idx + sizeof(uint64_t) <= size; idx += sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, bytes + idx, sizeof(uint64_t));
+      hash = (hash ^ (word * Prime)) * Prime;
+      hash ^= hash >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + idx, size - idx);
+    hash = (hash ^ (tail * Prime)) * Prime;
+    return hash ^ (hash >> 32);
+  }
+
+ private:
+  static size_t AlignUp(size_t offset) {
+    return (offset + Alignment - 1) / Alignment * Alignment;
+  }
+
+  const SectionEntry& Find(Kind kind) const {
+    for (size_t idx = 0; idx < num_sections_; ++idx) {
+      if (entries_[idx].kind == kind) return entries_[idx];
+    }
+    std::cerr << "Error: index file has no section " << kind << std::endl;
+    exit(1);
+  }
+
+  int fd_ = -1;
+  void* addr_ = NULL;
+  size_t file_size_ = 0;
+  size_t num_sections_ = 0;
+  const SectionEntry* entries_ = nullptr;
+};
+
+}  // mmap_struct
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <boost/serialization/binary_object.hpp>
+
+namespace ts {
+
+/* KeyTraits: order-preserving maps from key types to unsigned integers */
+
+// The radix table and the CHT work on the bits of the keys, so every index is
+// built over `Encode(key)`, an unsigned integer of at least 32 bits with
+// `a < b` iff `Encode(a) < Encode(b)`. `Decode` is the inverse.
+template <class KeyType, class Enable = void>
+struct KeyTraits {
+  static_assert(sizeof(KeyType) == 0, "KeyTraits: unsupported key type");
+};
+
+// Unsigned integers are used as is, but widened to 32 bits.
+template <class KeyType>
+struct KeyTraits<KeyType, std::enable_if_t<std::is_integral<KeyType>::value &&
+                                           std::is_unsigned<KeyType>::value>> {
+  using Unsigned = std::conditional_t<(sizeof(KeyType) < 4), uint32_t, KeyType>;
+
+  static Unsigned Encode(KeyType key) { return key; }
+  static KeyType Decode(Unsigned key) { return static_cast<KeyType>(key); }
+};
+
+// Signed integers are shifted by flipping the sign bit, which maps the
+// smallest value to 0.
+template <class KeyType>
+struct KeyTraits<KeyType, std::enable_if_t<std::is_integral<KeyType>::value &&
+                                           std::is_signed<KeyType>::value>> {
+  using Bits = std::make_unsigned_t<KeyType>;
+  using Unsigned = std::conditional_t<(sizeof(KeyType) < 4), uint32_t, Bits>;
+  static constexpr Bits SignBit = Bits(1) << (sizeof(KeyType) * 8 - 1);
+
+  static Unsigned Encode(KeyType key) { return static_cast<Bits>(key) ^ SignBit; }
+  static KeyType Decode(Unsigned key) { return static_cast<KeyType>(static_cast<Bits>(key) ^ SignBit); }
+};
+
+// IEEE-754 floats: negative values have all bits flipped, positive values
+// the sign bit. -0.0 is encoded as 0.0, NaN is not supported.
+template <class KeyType>
+struct KeyTraits<KeyType, std::enable_if_t<std::is_floating_point<KeyType>::value>> {
+  static_assert(sizeof(KeyType) == 4 || sizeof(KeyType) == 8,
+                "KeyTraits: only float and double are supported");
+  using Unsigned = std::conditional_t<sizeof(KeyType) == 4, uint32_t, uint64_t>;
+  static constexpr Unsigned SignBit = Unsigned(1) << (sizeof(KeyType) * 8 - 1);
+
+  static Unsigned Encode(KeyType key) {
+    if (key == 0) key = 0;
+    Unsigned bits;
+    memcpy(&bits, &key, sizeof(KeyType));
+    return (bits & SignBit) ? ~bits : (bits | SignBit);
+  }
+
+  static KeyType Decode(Unsigned bits) {
+    bits = (bits & SignBit) ? (bits & ~SignBit) : ~bits;
+    KeyType key;
+    memcpy(&key, &bits, sizeof(KeyType));
+    return key;
+  }
+};
+
+// 128-bit integers, which are not integral types in strict ISO mode.
+template <>
+struct KeyTraits<__uint128_t> {
+  using Unsigned = __uint128_t;
+
+  static Unsigned Encode(__uint128_t key) { return key; }
+  static __uint128_t Decode(Unsigned key) { return key; }
+};
+
+template <>
+struct KeyTraits<__int128_t> {
+  using Unsigned = __uint128_t;
+  static constexpr Unsigned SignBit = Unsigned(1) << 127;
+
+  static Unsigned Encode(__int128_t key) { return static_cast<Unsigned>(key) ^ SignBit; }
+  static __int128_t Decode(Unsigned key) { return static_cast<__int128_t>(key ^ SignBit); }
+};
+
+/* Bit operations over the encoded keys */
+
+// Returns the number of leading zero bits of `x`, which must not be 0.
+inline unsigned CountLeadingZeros(uint32_t x) { return __builtin_clz(x); }
+inline unsigned CountLeadingZeros(uint64_t x) { return __builtin_clzll(x); }
+inline unsigned CountLeadingZeros(__uint128_t x) {
+  const uint64_t high = static_cast<uint64_t>(x >> 64);
+  return high ? __builtin_clzll(high) : 64 + __builtin_clzll(static_cast<uint64_t>(x));
+}
+
+// Returns a 64-bit hash of `key`: the finalizer of MurmurHash3 over its
+// encoding, folded to 64 bits.
+template <class KeyType>
+uint64_t HashKey(KeyType key) {
+  const auto encoded = KeyTraits<KeyType>::Encode(key);
+  uint64_t hash = static_cast<uint64_t>(encoded);
+  if constexpr (sizeof(encoded) > sizeof(uint64_t)) {
+    hash ^= static_cast<uint64_t>(encoded >> 64) * 0x9e3779b97f4a7c15ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// Saves or loads an encoded `key` with a boost archive, which has no 128-bit
+// primitive: such keys are stored as raw bytes.
+template <class Archive, class Key>
+void SerializeKey(Archive& ar, Key& key) {
+  if constexpr (sizeof(Key) > sizeof(uint64_t)) {
+    ar & boost::serialization::make_binary_object(&key, sizeof(Key));
+  } else {
+    ar & key;
+  }
+}
+
+}  // namespace ts
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "builder.h"
+#include "parallel.h"
+#include "ts.h"
+
+namespace ts {
+
+// Stable, parallel sort of (key, payload) pairs that uses a `TrieSpline`
+// over a random sample of the keys as a partitioner: its estimated positions
+// scatter the pairs into many small buckets in key order, which are then
+// sorted independently.
+template <class KeyType, class ValueType>
+class LearnedSorter {
+ public:
+  using value_type = std::pair<KeyType, ValueType>;
+
+  // The sample spline is written under `model_path`. Uses `num_threads`
+  // threads, or one per hardware thread if 0.
+  LearnedSorter(fs::path model_path, size_t num_threads = 0)
+      : model_path_(model_path),
+        num_threads_(ResolveNumThreads(num_threads)) {}
+
+  void Sort(std::vector<value_type>& data) const {
+    const size_t size = data.size();
+    if (size < MinLearnedSize) {
+      std::stable_sort(data.begin(), data.end(), KeyLess);
+      return;
+    }
+    if (IsSorted(data)) return;
+
+    // Learn the CDF of a sample.
+    std::vector<KeyType> sample = Sample(data);
+    if (sample.front() == sample.back()) {
+      // Degenerate sample, nothing to learn.
+      std::stable_sort(data.begin(), data.end(), KeyLess);
+      return;
+    }
+    fs::create_directories(model_path_);
+    ts::Builder<KeyType> tsb(sample.front(), sample.back(), SampleMaxError, model_path_);
+    for (const auto& key : sample) tsb.AddKey(key);
+    const TrieSpline<KeyType> model = tsb.Finalize();
+
+    // Scatter into buckets by estimated position, then sort each bucket.
+    const size_t num_buckets = std::max<size_t>(1, size / BucketSize);
+    assert(num_buckets <= std::numeric_limits<uint32_t>::max());
+    const double scale = num_buckets / static_cast<double>(sample.size());
+    const auto bucket_of = [&](KeyType key) {
+      return std::min<size_t>(num_buckets - 1, model.GetEstimatedPosition(key) * scale);
+    };
+    std::vector<value_type> buffer(size);
+    const std::vector<size_t> bucket_begins = Scatter(data, buffer, num_buckets, bucket_of);
+    SortBuckets(buffer, bucket_begins);
+    data.swap(buffer);
+
+    // Float rounding at segment boundaries may put a key one bucket off.
+    if (!IsSorted(data)) {
+      std::stable_sort(data.begin(), data.end(), KeyLess);
+    }
+  }
+
+ private:
+  // Below this size the sort runs on one thread with `std::stable_sort`.
+  static constexpr size_t MinLearnedSize = size_t(1) << 14;
+  // Minimum number of elements per thread.
+  static constexpr size_t MinThreadSize = size_t(1) << 16;
+  // Number of sampled keys: one in `SampleRate`, at least `MinSampleSize`.
+  static constexpr size_t SampleRate = 100;
+  static constexpr size_t MinSampleSize = size_t(1) << 12;
+  // Spline error over the sample.
+  static constexpr size_t SampleMaxError = 32;
+  // Expected number of elements per bucket.
+  static constexpr size_t BucketSize = 256;
+
+  static bool KeyLess(const value_type& lhs, const value_type& rhs) {
+    return lhs.first < rhs.first;
+  }
+
+  size_t NumThreads(size_t size) const {
+    return NumThreadsFor(num_threads_, size, MinThreadSize);
+  }
+
+  bool IsSorted(const std::vector<value_type>& data) const {
+    const size_t num_threads = NumThreads(data.size());
+    std::vector<char> sorted(num_threads);
+    ParallelFor(num_threads, data.size(), [&](size_t t, size_t begin, size_t end) {
+      const auto first = data.begin() + std::max<size_t>(begin, 1) - 1;
+      sorted[t] = std::is_sorted(first, data.begin() + end, KeyLess);
+    });
+    return std::all_of(sorted.begin(), sorted.end(), [](char s) { return s; });
+  }
+
+  // Returns a sorted random sample of the keys.
+  std::vector<KeyType> Sample(const std::vector<value_type>& data) const {
+    const size_t sample_size = std::min(data.size(), std::max(MinSampleSize, data.size() / SampleRate));
+    std::mt19937_64 gen(data.size());
+    std::uniform_int_distribution<size_t> dist(0, data.size() - 1);
+    std::vector<KeyType> sample(sample_size);
+    for (auto& key : sample) key = data[dist(gen)].first;
+    std::sort(sample.begin(), sample.end());
+    return sample;
+  }
+
+  // Stably scatters `data` into `buffer` by `bucket_of`, and returns the
+  // start of each bucket in `buffer`, plus its size.
+  template <class BucketOf>
+  std::vector<size_t> Scatter(const std::vector<value_type>& data, std::vector<value_type>& buffer,
+                              size_t num_buckets, const BucketOf& bucket_of) const {
+    const size_t size = data.size();
+    const size_t num_threads = NumThreads(size);
+
+    // Per-thread bucket sizes. Bucket ids are kept to avoid a second
+    // evaluation of the model.
+    std::vector<uint32_t> buckets(size);
+    std::vector<std::vector<size_t>> offsets(num_threads, std::vector<size_t>(num_buckets, 0));
+    ParallelFor(num_threads, size, [&](size_t t, size_t begin, size_t end) {
+      for (size_t idx = begin; idx < end; ++idx) {
+        buckets[idx] = bucket_of(data[idx].first);
+        ++offsets[t][buckets[idx]];
+      }
+    });
+
+    // Thread `t` writes bucket `b` after all smaller buckets, and after
+    // bucket `b` of threads before it, which keeps the scatter stable.
+    std::vector<size_t> bucket_begins(num_buckets + 1);
+    size_t offset = 0;
+    for (size_t bucket = 0; bucket < num_buckets; ++bucket) {
+      bucket_begins[bucket] = offset;
+      for (size_t t = 0; t < num_threads; ++t) {
+        const size_t count = offsets[t][bucket];
+        offsets[t][bucket] = offset;
+        offset += count;
+      }
+    }
+    bucket_begins[num_buckets] = size;
+
+    ParallelFor(num_threads, size, [&](size_t t, size_t begin, size_t end) {
+      std::vector<size_t>& thread_offsets = offsets[t];
+      for (size_t idx = begin; idx < end; ++idx) {
+        buffer[thread_offsets[buckets[idx]]++] = data[idx];
+      }
+    });
+    return bucket_begins;
+  }
+
+  // Sorts every bucket of `data`, splitting the buckets into contiguous
+  // ranges of about equal numbers of elements across threads.
+  void SortBuckets(std::vector<value_type>& data, const std::vector<size_t>& bucket_begins) const {
+    const size_t num_buckets = bucket_begins.size() - 1;
+    const size_t num_threads = NumThreads(data.size());
+    ParallelFor(num_threads, data.size(), [&](size_t /*t*/, size_t begin, size_t end) {
+      // Sort the buckets that start in [begin, end).
+      const size_t first = std::lower_bound(bucket_begins.begin(), bucket_begins.end() - 1, begin) -
+                           bucket_begins.begin();
+      for (size_t bucket = first; bucket < num_buckets && bucket_begins[bucket] < end; ++bucket) {
+        const auto bucket_begin = data.begin() + bucket_begins[bucket];
+        const auto bucket_end = data.begin() + bucket_begins[bucket + 1];
+        if (bucket_end - bucket_begin > 1) std::stable_sort(bucket_begin, bucket_end, KeyLess);
+      }
+    });
+  }
+
+  fs::path model_path_;
+  size_t num_threads_;
+};
+
+}  // namespace ts
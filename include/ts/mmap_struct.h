@@ -15,6 +15,9 @@
 
 #include <iterator>
 #include <cstddef>
+#include <numeric>
+#include <thread>
+#include <vector>
 
 #ifndef __has_include
   static_assert(false, "__has_include not supported");
@@ -44,6 +47,119 @@
 
 namespace mmap_struct {
 
+/* Parallel file writer */
+
+struct WriteOptions {
+  size_t num_threads = 0;  // 0 for one per hardware thread
+  bool direct_io = false;  // write with O_DIRECT, bypassing the page cache
+};
+
+// Options used when a `LazyVector` builds a new file.
+inline WriteOptions& DefaultWriteOptions() {
+  static WriteOptions options;
+  return options;
+}
+
+// Writes `data_size` elements into a new file at `filepath`. The elements are
+// produced in chunks by `fill(out, begin, count)`, which stores elements
+// [begin, begin + count) into `out`. Threads write disjoint ranges of chunks
+// with `pwrite` from their own aligned buffers, and the file is synced with
+// `fdatasync` at the end.
+template <class K, class Fill>
+void WriteFile(fs::path filepath, size_t data_size, Fill fill, const WriteOptions& options) {
+  static constexpr size_t Alignment = 4096;  // for O_DIRECT
+  static constexpr size_t ChunkBytes = 4 << 20;
+  const char* filename = filepath.c_str();
+  const size_t file_size = data_size * sizeof(K);
+
+  // open file
+  int fd = -1;
+  if (options.direct_io) {
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0) {
+      int errnum = errno;
+      std::cerr << "Cannot use O_DIRECT for " << filename << " (" << strerror(errnum)
+                << "), writing through the page cache" << std::endl;
+    }
+  }
+  if (fd < 0) fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    int errnum = errno;
+    std::cerr << "Error write-opening " << filename << ": " << strerror(errnum) << std::endl;
+    exit(1);
+  }
+
+  // allocate space on the file
+  int fa = fallocate(fd, 0 /*allocating disk space*/, 0, file_size);
+  if (fa != 0) {
+    int errnum = errno;
+    std::cerr << "Error allocating space: " << strerror(errnum) << std::endl;
+    exit(1);
+  }
+
+  // Chunks hold a whole number of elements and are a multiple of `Alignment`
+  // bytes, so every chunk starts aligned in the file.
+  const size_t unit = std::lcm(sizeof(K), Alignment) / sizeof(K);
+  const size_t chunk_size = std::max<size_t>(1, ChunkBytes / (unit * sizeof(K))) * unit;
+  const size_t num_chunks = (data_size + chunk_size - 1) / chunk_size;
+  const size_t max_threads = options.num_threads > 0
+                                 ? options.num_threads
+                                 : std::max<unsigned>(1, std::thread::hardware_concurrency());
+  const size_t num_threads = std::max<size_t>(1, std::min(max_threads, num_chunks));
+
+  const auto write_chunks = [&](size_t first_chunk, size_t last_chunk) {
+    void* buffer;
+    if (posix_memalign(&buffer, Alignment, chunk_size * sizeof(K)) != 0) {
+      std::cerr << "Error allocating write buffer" << std::endl;
+      exit(1);
+    }
+    K* elements = reinterpret_cast<K*>(buffer);
+    for (size_t chunk = first_chunk; chunk < last_chunk; ++chunk) {
+      const size_t begin = chunk * chunk_size;
+      const size_t count = std::min(chunk_size, data_size - begin);
+      fill(elements, begin, count);
+
+      // O_DIRECT needs whole blocks: the tail is padded and cut off later.
+      const size_t bytes = count * sizeof(K);
+      const size_t padded_bytes = (bytes + Alignment - 1) / Alignment * Alignment;
+      memset(reinterpret_cast<char*>(buffer) + bytes, 0, padded_bytes - bytes);
+      const char* out = reinterpret_cast<const char*>(buffer);
+      size_t offset = begin * sizeof(K);
+      size_t remaining = padded_bytes;
+      while (remaining > 0) {
+        ssize_t written = pwrite(fd, out, remaining, offset);
+        if (written < 0) {
+          int errnum = errno;
+          std::cerr << "Error writing " << filename << ": " << strerror(errnum) << std::endl;
+          exit(1);
+        }
+        out += written;
+        offset += written;
+        remaining -= written;
+      }
+    }
+    free(buffer);
+  };
+
+  if (num_threads == 1) {
+    write_chunks(0, num_chunks);
+  } else {
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back(write_chunks, num_chunks * t / num_threads, num_chunks * (t + 1) / num_threads);
+    }
+    for (auto& thread : threads) thread.join();
+  }
+
+  if (ftruncate(fd, file_size) != 0) {
+    int errnum = errno;
+    std::cerr << "Error truncating " << filename << ": " << strerror(errnum) << std::endl;
+    exit(1);
+  }
+  fdatasync(fd);
+  close(fd);
+}
+
 /* LazyVector: mmap-based array */
 
 template<class K>
@@ -73,9 +189,17 @@ class LazyVector {
     return *this;
   }
 
-  LazyVector(const std::vector<K>& source, fs::path filepath) {  // Build new file from vector
+  LazyVector(const std::vector<K>& source, fs::path filepath)  // Build new file from vector
+      : LazyVector(source.size(), filepath, [&source](K* out, size_t begin, size_t count) {
+          std::copy(source.begin() + begin, source.begin() + begin + count, out);
+        }) {}
+
+  // Build new file of `data_size` elements produced by `fill(out, begin, count)`
+  // (see `WriteFile`), without materializing them in memory first
+  template <class Fill>
+  LazyVector(size_t data_size, fs::path filepath, Fill fill,
+             const WriteOptions& options = DefaultWriteOptions()) {
     const char* filename = filepath.c_str();
-    size_t data_size = source.size();
     size_t file_size = data_size * sizeof(K);
 
     // prepare directory
@@ -84,36 +208,25 @@ class LazyVector {
       std::cout << "Created directory " << filepath.parent_path() << std::endl;
     }
 
+    // write the file
+    WriteFile<K>(filepath, data_size, fill, options);
+
     // open file
-    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int fd = open(filename, O_RDONLY);
     if (fd < 0) {
       int errnum = errno;
-      std::cerr << "Error write-opening " << filename << ": " << strerror(errnum) << std::endl;
-      exit(1);
-    }
-
-    // allocate space on the file
-    int fa = fallocate(fd, 0 /*allocating disk space*/, 0, file_size);
-    if (fa != 0) {
-      int errnum = errno;
-      std::cerr << "Error allocating space: " << strerror(errnum) << std::endl;
+      std::cerr << "Error read-opening " << filename << ": " << strerror(errnum) << std::endl;
       exit(1);
     }
 
     // mmap
-    void* addr = mmap(NULL, file_size, PROT_WRITE, MAP_SHARED, fd, 0);
+    void* addr = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
     if (addr == MAP_FAILED) {
       int errnum = errno;
       std::cerr << "Error mmap data of size " << file_size << " bytes" << ": " << strerror(errnum) << std::endl;
       exit(1);
     }
     K* whole_data = reinterpret_cast<K*>(addr);
-
-    // write element to mmap-ed array
-    for (size_t idx = 0; idx < data_size; ++idx) {
-      whole_data[idx] = source[idx];
-    }
-    msync(addr, file_size, MS_SYNC);
     std::cout << "Written to " << filepath << " with size " << file_size << " bytes, at " << addr << std::endl;
 
     // assign to class
@@ -159,6 +272,14 @@ class LazyVector {
     this->file_size_ = file_size;
   }
 
+  LazyVector(const K* begin, const size_t data_size) {  // Non-owning view, e.g. into an `IndexFile`
+    this->size_ = data_size;
+    this->begin_ = const_cast<K*>(begin);
+    this->fd_ = -1;
+    this->addr_ = NULL;
+    this->file_size_ = 0;
+  }
+
   ~LazyVector() {
     if (this->addr_ != NULL) {
       munmap(this->addr_, this->file_size_);
@@ -178,7 +299,7 @@ class LazyVector {
     return Iterator(this->begin_ + this->size_, this->begin_, this->begin_ + this->size_);
   }
 
-  K& operator[](int index) const {
+  K& operator[](size_t index) const {
     return this->begin_[index];
   }
 
@@ -186,6 +307,10 @@ class LazyVector {
     return this->size_;
   }
 
+  K* data() const {
+    return this->begin_;
+  }
+
   size_t into_file(const char* filename) {
     throw std::runtime_error("LazyVector does not implement into_file.");
   }
@@ -242,7 +367,7 @@ class LazyVector<K>::Iterator {
     return temp;
   }
 
-  Iterator operator+(int jump) noexcept {
+  Iterator operator+(difference_type jump) noexcept {
     // std::cout << "Jumpping " << jump << ", " << this->ptr_ + jump << " [" << this->begin_ << ", " << this->end_ << "]" << std::endl;
     return Iterator(this->ptr_ + jump, this->begin_, this->end_);
   }
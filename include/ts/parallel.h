@@ -0,0 +1,38 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace ts {
+
+/* Splitting in-memory work over threads, as the sorters do */
+
+// Returns `num_threads`, or one per hardware thread if 0.
+inline size_t ResolveNumThreads(size_t num_threads) {
+  return num_threads > 0 ? num_threads : std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+// Returns the number of threads to split `size` elements over: at most
+// `max_threads`, with at least `min_thread_size` elements each.
+inline size_t NumThreadsFor(size_t max_threads, size_t size, size_t min_thread_size) {
+  return std::max<size_t>(1, std::min(max_threads, size / min_thread_size));
+}
+
+// Runs `fn(thread_idx, begin, end)` on `num_threads` contiguous slices of
+// [0, `size`).
+template <class Fn>
+void ParallelFor(size_t num_threads, size_t size, Fn fn) {
+  if (num_threads == 1) {
+    fn(0, 0, size);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back(fn, t, size * t / num_threads, size * (t + 1) / num_threads);
+  }
+  for (auto& thread : threads) thread.join();
+}
+
+}  // namespace ts
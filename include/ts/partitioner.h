@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "ts.h"
+
+namespace ts {
+
+/* Partitioner: equi-depth range partitioning with a spline as the model */
+
+// Splits the key space into `num_partitions` ranges of about equal numbers of
+// keys. Partition `p` holds the keys in [boundaries[p - 1], boundaries[p]),
+// where the `num_partitions - 1` boundaries are quantiles of the model (see
+// `TrieSpline::EstimateQuantile`), which may be built over the data or over a
+// sample of it. Keys are assigned by scaling their estimated position to a
+// partition, then stepping over the boundaries until the partition is exact,
+// so there is no binary search over the boundaries.
+//
+// `Index` is either `ts::TrieSpline` or `ts::CompactTrieSpline`, and must
+// outlive the partitioner.
+template <class KeyType, class Index = TrieSpline<KeyType>>
+class Partitioner {
+ public:
+  Partitioner(const Index& model, size_t num_partitions)
+      : model_(model), num_partitions_(num_partitions) {
+    assert(num_partitions > 0 && num_partitions <= UINT32_MAX);
+    assert(model.GetNumKeys() > 0);
+    boundaries_.reserve(num_partitions - 1);
+    for (size_t p = 1; p < num_partitions; ++p) {
+      boundaries_.push_back(model.EstimateQuantile(static_cast<double>(p) / num_partitions));
+    }
+    // Estimated positions range over [0, num_keys - 1].
+    scale_ = model.GetNumKeys() > 1 ? num_partitions / static_cast<double>(model.GetNumKeys() - 1) : 0;
+  }
+
+  // Returns the partition of `key`.
+  uint32_t GetPartition(const KeyType key) const {
+    return Correct(key, Guess(key));
+  }
+
+  // Writes the partition of `keys[idx]` into `partitions[idx]`, for all `idx`
+  // in [0, `num_keys`). The model is evaluated for the whole batch first,
+  // which keeps its lookups independent of each other.
+  void GetPartitions(const KeyType* keys, size_t num_keys, uint32_t* partitions) const {
+    for (size_t idx = 0; idx < num_keys; ++idx) partitions[idx] = Guess(keys[idx]);
+    for (size_t idx = 0; idx < num_keys; ++idx) partitions[idx] = Correct(keys[idx], partitions[idx]);
+  }
+
+  // Returns the `num_partitions - 1` boundaries between the partitions.
+  const std::vector<KeyType>& GetBoundaries() const { return boundaries_; }
+
+  size_t GetNumPartitions() const { return num_partitions_; }
+
+ private:
+  // Returns the partition of the estimated position of `key`.
+  uint32_t Guess(const KeyType key) const {
+    const double partition = model_.GetEstimatedPosition(key) * scale_;
+    return std::min<double>(partition, num_partitions_ - 1);
+  }
+
+  // Returns the exact partition of `key`, starting at `partition`.
+  uint32_t Correct(const KeyType key, uint32_t partition) const {
+    while (partition > 0 && key < boundaries_[partition - 1]) --partition;
+    while (partition + 1 < num_partitions_ && !(key < boundaries_[partition])) ++partition;
+    return partition;
+  }
+
+  const Index& model_;
+  size_t num_partitions_;
+  double scale_;
+  std::vector<KeyType> boundaries_;
+};
+
+}  // namespace ts
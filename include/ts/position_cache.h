@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+#include "key_traits.h"
+
+namespace ts {
+
+/* PositionCache: concurrent cache of lookup results, from key to position */
+
+// Set-associative: a key may only be cached in the `Ways` slots of the set
+// chosen by its hash, and each set evicts by CLOCK. A hit sets the
+// reference bit of its slot, and an insert into a full set clears the
+// reference bits from the set's hand on until it finds an unreferenced slot.
+// New slots start unreferenced, so keys seen once are evicted first.
+//
+// Every set is guarded by a sequence lock: lookups never block and retry
+// nothing (a lookup that races with an insert into its set is a miss), and
+// an insert into a set that is being written to is dropped. Hits and misses
+// are only counted with `count_lookups`, since shared counters would be
+// written by every lookup; under concurrent lookups, the counts are
+// approximate.
+template <class KeyType>
+class PositionCache {
+ public:
+  static constexpr size_t Ways = 4;
+
+  // Caches about `num_entries` keys, rounded up to a power of two number of
+  // sets.
+  PositionCache(size_t num_entries, bool count_lookups = false) : count_lookups_(count_lookups) {
+    num_sets_ = 1;
+    while (num_sets_ * Ways < num_entries) num_sets_ <<= 1;
+    sets_ = std::make_unique<Set[]>(num_sets_);
+  }
+
+  // Returns true and sets `position` if `key` is cached.
+  bool Lookup(const KeyType key, size_t& position) const {
+    Set& set = GetSet(key);
+    const uint32_t version = set.version.load(std::memory_order_acquire);
+    if (version & 1) return Miss();
+
+    const uint64_t bits = Bits(key);
+    const uint8_t valid = set.valid.load(std::memory_order_relaxed);
+    for (size_t way = 0; way < Ways; ++way) {
+      if (!(valid & (1u << way)) || set.keys[way].load(std::memory_order_relaxed) != bits) continue;
+      const uint64_t found = set.positions[way].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (set.version.load(std::memory_order_relaxed) != version) return Miss();
+
+      // Only write the reference bit if it is not set yet.
+      if (!(set.referenced.load(std::memory_order_relaxed) & (1u << way))) {
+        set.referenced.fetch_or(1u << way, std::memory_order_relaxed);
+      }
+      position = found;
+      if (count_lookups_) Increment(hits_);
+      return true;
+    }
+    return Miss();
+  }
+
+  // Caches `position` for `key`, evicting by CLOCK if its set is full.
+  void Insert(const KeyType key, const size_t position) {
+    Set& set = GetSet(key);
+    uint32_t version = set.version.load(std::memory_order_relaxed);
+    if ((version & 1) ||
+        !set.version.compare_exchange_strong(version, version + 1, std::memory_order_acquire)) {
+      return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const uint64_t bits = Bits(key);
+    const uint8_t valid = set.valid.load(std::memory_order_relaxed);
+    size_t victim = Ways;
+    for (size_t way = 0; way < Ways; ++way) {
+      if ((valid & (1u << way)) && set.keys[way].load(std::memory_order_relaxed) == bits) {
+        victim = way;
+        break;
+      }
+    }
+    if (victim == Ways) {
+      // CLOCK: an empty slot, or the first unreferenced one from the hand.
+      // Reference bits set by concurrent hits meanwhile may be lost.
+      uint8_t referenced = set.referenced.load(std::memory_order_relaxed);
+      for (;; set.hand = (set.hand + 1) % Ways) {
+        const uint8_t mask = 1u << set.hand;
+        if (!(valid & mask) || !(referenced & mask)) break;
+        referenced &= ~mask;
+      }
+      victim = set.hand;
+      set.hand = (set.hand + 1) % Ways;
+      set.referenced.store(referenced & ~(1u << victim), std::memory_order_relaxed);
+    }
+    set.keys[victim].store(bits, std::memory_order_relaxed);
+    set.positions[victim].store(position, std::memory_order_relaxed);
+    set.valid.store(valid | (1u << victim), std::memory_order_relaxed);
+
+    set.version.store(version + 2, std::memory_order_release);
+  }
+
+  // Returns the number of entries.
+  size_t GetCapacity() const { return num_sets_ * Ways; }
+
+  size_t GetNumHits() const { return hits_.load(std::memory_order_relaxed); }
+  size_t GetNumMisses() const { return misses_.load(std::memory_order_relaxed); }
+
+  // Returns the size in bytes.
+  size_t GetSize() const { return sizeof(*this) + num_sets_ * sizeof(Set); }
+
+ private:
+  static_assert(sizeof(typename KeyTraits<KeyType>::Unsigned) <= sizeof(uint64_t),
+                "PositionCache: keys wider than 64 bits");
+
+  struct alignas(64) Set {
+    std::atomic<uint32_t> version{0};  // Odd while an insert is writing the set.
+    std::atomic<uint8_t> valid{0};
+    std::atomic<uint8_t> referenced{0};
+    uint8_t hand = 0;  // Only accessed by inserts.
+    std::atomic<uint64_t> keys[Ways] = {};
+    std::atomic<uint64_t> positions[Ways] = {};
+  };
+
+  static uint64_t Bits(const KeyType key) { return KeyTraits<KeyType>::Encode(key); }
+
+  Set& GetSet(const KeyType key) const {
+    return sets_[HashKey(key) & (num_sets_ - 1)];
+  }
+
+  bool Miss() const {
+    if (count_lookups_) Increment(misses_);
+    return false;
+  }
+
+  // Not atomic, to not lock the bus on every lookup.
+  static void Increment(std::atomic<size_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  bool count_lookups_;
+  size_t num_sets_;
+  std::unique_ptr<Set[]> sets_;
+  mutable std::atomic<size_t> hits_{0};
+  mutable std::atomic<size_t> misses_{0};
+};
+
+}  // namespace ts
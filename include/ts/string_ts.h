@@ -0,0 +1,526 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/serialization/array_wrapper.hpp>
+#include <boost/serialization/string.hpp>
+
+#include "builder.h"
+#include "common.h"
+#include "ts.h"
+
+#include "mmap_struct.h"
+
+namespace ts {
+
+/* StringTrieSpline: learned index over sorted, variable-length byte strings */
+
+// Keys are indexed by 8-byte big-endian chunks, which are order-preserving
+// but not unique. The root node indexes the chunk right after the longest
+// common prefix of all keys. Every run of more than `spline_max_error` keys
+// with the same chunk (and more bytes to tell them apart) becomes a child
+// node, which skips the common prefix of the run and indexes the next chunk,
+// like a trie. Nodes of the same depth form a level, with a single
+// `TrieSpline` over the 128-bit keys (node index, chunk). The last key of a
+// run with a child, and of the last run of a level, is keyed one past the
+// chunk, so that the spline also sees where the run ends.
+//
+// Equal keys are supported, but their runs widen all bounds of their level.
+class StringTrieSpline {
+ public:
+  using Key = __uint128_t;
+
+  StringTrieSpline() = default;
+
+  StringTrieSpline(fs::path root_path) : root_path_(root_path) {}
+
+  // Returns a search bound [begin, end) of the positions of the keys that
+  // may be the first one not less than `key`.
+  SearchBound GetSearchBound(std::string_view key) const {
+    if (levels_.empty()) return SearchBound{0, num_keys_};
+
+    size_t node_index = 0;
+    for (size_t depth = 0;; ++depth) {
+      const Level& level = *levels_[depth];
+      const Node& node = level.nodes[node_index];
+
+      // Does `key` share the prefix skipped by this node?
+      const size_t prefix_size = node.prefix_end - node.prefix_begin;
+      const size_t prefix_start = std::min(node.offset - prefix_size, key.size());
+      const int cmp = key.substr(prefix_start, prefix_size)
+                          .compare(std::string_view(level.prefixes).substr(node.prefix_begin, prefix_size));
+      if (cmp < 0) return SearchBound{node.begin, node.begin};
+      if (cmp > 0) return SearchBound{node.end, node.end};
+
+      // Descend if the chunk has a child.
+      const uint64_t chunk = Chunk(key, node.offset);
+      const auto first = level.children.begin() + node.children_begin;
+      const auto last = level.children.begin() + node.children_end;
+      const auto child = std::lower_bound(first, last, chunk, [](const Child& child, uint64_t chunk) {
+        return child.chunk < chunk;
+      });
+      if (child != last && child->chunk == chunk) {
+        node_index = child->node;
+        continue;
+      }
+
+      // Translate the bound within the level into one within the node. Runs
+      // of equal chunks without child extend past the estimate.
+      SearchBound bound{node.rank, node.rank + 1};
+      if (level.spline) bound = level.spline->GetSearchBound(Composite(node_index, chunk));
+      const size_t node_size = node.end - node.begin;
+      const size_t begin = std::min(node_size, bound.begin - std::min(bound.begin, node.rank));
+      const size_t end = std::min(node_size, bound.end + level.max_run - std::min(bound.end, node.rank));
+      return SearchBound{node.begin + begin, node.begin + std::max(begin, end)};
+    }
+  }
+
+  // Returns the number of levels of the trie.
+  size_t GetNumLevels() const { return levels_.size(); }
+
+  // Returns the size in bytes.
+  size_t GetSize() const {
+    size_t size = sizeof(*this);
+    for (const auto& level : levels_) {
+      size += sizeof(Level) + level->nodes.size() * sizeof(Node) +
+              level->children.size() * sizeof(Child) + level->prefixes.size();
+      if (level->spline) size += level->spline->GetSize();
+    }
+    return size;
+  }
+
+  // Returns the big-endian `Chunk` of `key` at byte `offset`, padded with
+  // zeros.
+  static uint64_t Chunk(std::string_view key, size_t offset) {
+    uint64_t chunk = 0;
+    if (offset < key.size()) {
+      memcpy(&chunk, key.data() + offset, std::min<size_t>(sizeof(chunk), key.size() - offset));
+    }
+    return __builtin_bswap64(chunk);
+  }
+
+ private:
+  // A node covers the keys at positions [begin, end), which share their first
+  // `offset` bytes. Bytes [offset - prefix size, offset) are in the level's
+  // `prefixes` at [prefix_begin, prefix_end).
+  struct Node {
+    size_t begin;
+    size_t end;
+    // Position of the first key of the node among all keys of the level.
+    size_t rank;
+    size_t offset;
+    size_t prefix_begin;
+    size_t prefix_end;
+    // Children of the node, in the level's `children`, sorted by chunk.
+    size_t children_begin;
+    size_t children_end;
+  };
+
+  struct Child {
+    uint64_t chunk;
+    // Index of the child in the next level.
+    size_t node;
+  };
+
+  struct Level {
+    std::vector<Node> nodes;
+    std::vector<Child> children;
+    std::string prefixes;
+    // Longest run of keys with the same chunk in a node, that has no child.
+    size_t max_run = 1;
+    // Over `Composite(node index, chunk)` of all keys of the level. Missing
+    // if all keys share the same one.
+    std::unique_ptr<TrieSpline<Key>> spline;
+  };
+
+  static Key Composite(size_t node_index, uint64_t chunk) {
+    return (static_cast<Key>(node_index) << 64) | chunk;
+  }
+
+  fs::path make_level_path(size_t depth) const {
+    return this->root_path_ / ("level_" + std::to_string(depth));
+  }
+
+  size_t num_keys_ = 0;
+  std::vector<std::unique_ptr<Level>> levels_;
+  fs::path root_path_;
+
+  friend class StringBuilder;
+
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void save(Archive & ar, const unsigned int version __attribute__((unused))) const {
+    ar << this->num_keys_;
+    ar << this->levels_.size();
+    for (const auto& level : this->levels_) {
+      SaveArray(ar, level->nodes);
+      SaveArray(ar, level->children);
+      ar << level->prefixes;
+      ar << level->max_run;
+      const bool has_spline = level->spline != nullptr;
+      ar << has_spline;
+      if (has_spline) ar << *level->spline;
+    }
+  }
+
+  template<class Archive>
+  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+    ar >> this->num_keys_;
+    size_t num_levels; ar >> num_levels;
+    this->levels_.clear();
+    for (size_t depth = 0; depth < num_levels; ++depth) {
+      auto level = std::make_unique<Level>();
+      LoadArray(ar, level->nodes);
+      LoadArray(ar, level->children);
+      ar >> level->prefixes;
+      ar >> level->max_run;
+      bool has_spline; ar >> has_spline;
+      if (has_spline) {
+        level->spline = std::make_unique<TrieSpline<Key>>(this->make_level_path(depth));
+        ar >> *level->spline;
+      }
+      this->levels_.push_back(std::move(level));
+    }
+  }
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+  template <class Archive, class T>
+  static void SaveArray(Archive& ar, const std::vector<T>& values) {
+    ar << values.size();
+    ar << boost::serialization::make_array(reinterpret_cast<const char*>(values.data()),
+                                           values.size() * sizeof(T));
+  }
+
+  template <class Archive, class T>
+  static void LoadArray(Archive& ar, std::vector<T>& values) {
+    size_t size; ar >> size;
+    values.resize(size);
+    ar >> boost::serialization::make_array(reinterpret_cast<char*>(values.data()),
+                                           size * sizeof(T));
+  }
+};
+
+// Builds a `StringTrieSpline` over sorted keys. The spline of level `d` is
+// written under `root_path / "level_d"`.
+class StringBuilder {
+ public:
+  StringBuilder(size_t spline_max_error, fs::path root_path)
+      : spline_max_error_(spline_max_error), root_path_(root_path), offsets_{0} {}
+
+  // Adds a key, not less than the previous one.
+  void AddKey(std::string_view key) {
+    assert(offsets_.size() == 1 || GetKey(offsets_.size() - 2) <= key);
+    bytes_.append(key);
+    offsets_.push_back(bytes_.size());
+  }
+
+  // Finalizes the construction and returns a read-only `StringTrieSpline`.
+  StringTrieSpline Finalize() {
+    using Node = StringTrieSpline::Node;
+    using Level = StringTrieSpline::Level;
+    StringTrieSpline sts(root_path_);
+    sts.num_keys_ = NumKeys();
+    if (NumKeys() == 0) return sts;
+
+    // The root skips the common prefix of all keys.
+    std::vector<Node> nodes(1);
+    std::string prefixes;
+    const size_t lcp = ComputeLcp(GetKey(0), GetKey(NumKeys() - 1));
+    AddNode(nodes[0], 0, NumKeys(), 0, 0, lcp, prefixes);
+
+    for (size_t depth = 0; !nodes.empty(); ++depth) {
+      auto level = std::make_unique<Level>();
+      level->nodes = std::move(nodes);
+      level->prefixes = std::move(prefixes);
+      nodes.clear();
+      prefixes.clear();
+
+      // Split every node into runs of keys with the same chunk.
+      const Node& first_node = level->nodes.front();
+      const Node& last_node = level->nodes.back();
+      const auto min_key = StringTrieSpline::Composite(
+          0, StringTrieSpline::Chunk(GetKey(first_node.begin), first_node.offset));
+      const auto max_key = LastKey(level->nodes.size() - 1, last_node);
+      std::optional<Builder<StringTrieSpline::Key>> tsb;
+      if (min_key != max_key) tsb.emplace(min_key, max_key, spline_max_error_, sts.make_level_path(depth));
+
+      size_t next_rank = 0;
+      for (size_t node_index = 0; node_index != level->nodes.size(); ++node_index) {
+        Node& node = level->nodes[node_index];
+        node.children_begin = level->children.size();
+        for (size_t begin = node.begin, end; begin != node.end; begin = end) {
+          const uint64_t chunk = StringTrieSpline::Chunk(GetKey(begin), node.offset);
+          std::optional<uint64_t> next_chunk;
+          size_t max_size = GetKey(begin).size();
+          for (end = begin + 1; end != node.end; ++end) {
+            const uint64_t end_chunk = StringTrieSpline::Chunk(GetKey(end), node.offset);
+            if (end_chunk != chunk) {
+              next_chunk = end_chunk;
+              break;
+            }
+            max_size = std::max(max_size, GetKey(end).size());
+          }
+          const size_t run = end - begin;
+          const bool has_child = HasChild(run, max_size, node.offset);
+          if (tsb) {
+            const auto key = StringTrieSpline::Composite(node_index, chunk);
+            for (size_t idx = begin; idx + 1 != end; ++idx) tsb->AddKey(key);
+            const bool is_last = node_index + 1 == level->nodes.size() && end == node.end;
+            const bool skip = (has_child || is_last) && run > 1 && next_chunk != chunk + 1;
+            tsb->AddKey(skip ? key + 1 : key);
+          }
+
+          if (has_child) {
+            const size_t child_offset = std::max(node.offset + sizeof(uint64_t),
+                                                 ComputeLcp(GetKey(begin), GetKey(end - 1)));
+            level->children.push_back({chunk, nodes.size()});
+            nodes.emplace_back();
+            AddNode(nodes.back(), begin, end, next_rank, node.offset + sizeof(uint64_t), child_offset,
+                    prefixes);
+            next_rank += run;
+          } else {
+            level->max_run = std::max(level->max_run, run);
+          }
+        }
+        node.children_end = level->children.size();
+      }
+      if (tsb) level->spline.reset(new TrieSpline<StringTrieSpline::Key>(tsb->Finalize()));
+      sts.levels_.push_back(std::move(level));
+    }
+    return sts;
+  }
+
+ private:
+  size_t NumKeys() const { return offsets_.size() - 1; }
+
+  std::string_view GetKey(size_t index) const {
+    return std::string_view(bytes_.data() + offsets_[index], offsets_[index + 1] - offsets_[index]);
+  }
+
+  // Whether a run of `run` keys of at most `max_size` bytes, with the same
+  // chunk at `offset`, becomes a child. Keys that only differ in trailing
+  // zeros cannot be told apart by chunks.
+  bool HasChild(size_t run, size_t max_size, size_t offset) const {
+    return run > spline_max_error_ && max_size > offset + sizeof(uint64_t);
+  }
+
+  // Returns the key of the last position of `node`, the last node of its
+  // level, in the spline of the level.
+  StringTrieSpline::Key LastKey(size_t node_index, const StringTrieSpline::Node& node) const {
+    const uint64_t chunk = StringTrieSpline::Chunk(GetKey(node.end - 1), node.offset);
+    const bool is_run = node.end - node.begin > 1 &&
+                        StringTrieSpline::Chunk(GetKey(node.end - 2), node.offset) == chunk;
+    return StringTrieSpline::Composite(node_index, chunk) + is_run;
+  }
+
+  static size_t ComputeLcp(std::string_view lhs, std::string_view rhs) {
+    const size_t size = std::min(lhs.size(), rhs.size());
+    return std::mismatch(lhs.begin(), lhs.begin() + size, rhs.begin()).first - lhs.begin();
+  }
+
+  // Sets up `node` for the keys in [begin, end), which skips their common
+  // bytes [prefix_start, offset).
+  void AddNode(StringTrieSpline::Node& node, size_t begin, size_t end, size_t rank,
+               size_t prefix_start, size_t offset, std::string& prefixes) const {
+    node.begin = begin;
+    node.end = end;
+    node.rank = rank;
+    node.offset = offset;
+    node.prefix_begin = prefixes.size();
+    const std::string_view key = GetKey(begin);
+    prefixes.append(key.substr(std::min(prefix_start, key.size()), offset - prefix_start));
+    node.prefix_end = prefixes.size();
+    node.children_begin = node.children_end = 0;
+  }
+
+  size_t spline_max_error_;
+  fs::path root_path_;
+
+  // Key `i` is `bytes_[offsets_[i], offsets_[i + 1])`.
+  std::string bytes_;
+  std::vector<size_t> offsets_;
+};
+
+/* StringStore: sorted strings in prefix-compressed pages */
+
+// Keys are front-coded against the previous key of their page: each entry is
+// the varint length of the prefix shared with the previous key, the varint
+// length of the rest, and the rest. Pages are at most `PageSize` bytes, unless
+// they hold a single longer key, and are decoded independently.
+class StringStore {
+ public:
+  static constexpr size_t PageSize = 4096;
+
+  StringStore() = default;
+
+  StringStore(fs::path root_path) : root_path_(root_path) {}
+
+  // Writes `num_keys` sorted keys, the `i`th being `key_at(i)`, to
+  // `root_path / "strings"`.
+  template <class KeyAt>
+  StringStore(size_t num_keys, KeyAt key_at, fs::path root_path)
+      : num_keys_(num_keys), root_path_(root_path) {
+    std::vector<char> bytes;
+    std::string prev_key;
+    for (size_t idx = 0; idx < num_keys; ++idx) {
+      const std::string_view key = key_at(idx);
+      size_t shared = 0;
+      if (!page_begins_.empty()) {
+        const size_t size = std::min(prev_key.size(), key.size());
+        shared = std::mismatch(prev_key.begin(), prev_key.begin() + size, key.begin()).first -
+                 prev_key.begin();
+      }
+      const size_t entry_size = VarintSize(shared) + VarintSize(key.size() - shared) + key.size() - shared;
+
+      // Start a new page, with the key stored in full.
+      if (page_begins_.empty() || bytes.size() - page_offsets_.back() + entry_size > PageSize) {
+        page_begins_.push_back(idx);
+        page_offsets_.push_back(bytes.size());
+        shared = 0;
+      }
+      AppendVarint(bytes, shared);
+      AppendVarint(bytes, key.size() - shared);
+      bytes.insert(bytes.end(), key.begin() + shared, key.end());
+      prev_key.assign(key);
+    }
+    page_offsets_.push_back(bytes.size());
+    if (!bytes.empty()) data_ = mmap_struct::LazyVector<char>(bytes, make_data_path());
+  }
+
+  size_t size() const { return num_keys_; }
+
+  // Returns the key at position `index`.
+  std::string Get(size_t index) const {
+    assert(index < num_keys_);
+    PageCursor cursor(*this, FindPage(index));
+    while (cursor.index < index) cursor.Next();
+    return cursor.key;
+  }
+
+  // Returns the position of the first key not less than `key` in
+  // [`bound.begin`, `bound.end`), or `bound.end` if there is none. Only the
+  // keys inside the bound are compared.
+  size_t LowerBound(std::string_view key, SearchBound bound) const {
+    if (bound.begin >= bound.end) return bound.end;
+    PageCursor cursor(*this, FindPage(bound.begin));
+    while (cursor.index < bound.begin) cursor.Next();
+    while (std::string_view(cursor.key) < key) {
+      if (cursor.index + 1 == bound.end) return bound.end;
+      cursor.Next();
+    }
+    return cursor.index;
+  }
+
+  // Returns the size in bytes.
+  size_t GetSize() const {
+    return sizeof(*this) + data_.size() + page_begins_.size() * sizeof(size_t) +
+           page_offsets_.size() * sizeof(size_t);
+  }
+
+ private:
+  // Decodes the keys of the store in order, starting at a page.
+  struct PageCursor {
+    PageCursor(const StringStore& store, size_t page)
+        : store(store), page(page), index(store.page_begins_[page]),
+          ptr(store.data_.data() + store.page_offsets_[page]) {
+      Decode();
+    }
+
+    void Next() {
+      ++index;
+      if (page + 1 < store.page_begins_.size() && index == store.page_begins_[page + 1]) {
+        ++page;
+        key.clear();
+      }
+      Decode();
+    }
+
+    void Decode() {
+      const size_t shared = ReadVarint(ptr);
+      const size_t rest = ReadVarint(ptr);
+      key.resize(shared);
+      key.append(ptr, rest);
+      ptr += rest;
+    }
+
+    const StringStore& store;
+    size_t page;
+    size_t index;
+    const char* ptr;
+    std::string key;
+  };
+
+  size_t FindPage(size_t index) const {
+    return std::upper_bound(page_begins_.begin(), page_begins_.end(), index) - page_begins_.begin() - 1;
+  }
+
+  static size_t VarintSize(size_t value) {
+    size_t size = 1;
+    for (; value >= 0x80; value >>= 7) ++size;
+    return size;
+  }
+
+  static void AppendVarint(std::vector<char>& bytes, size_t value) {
+    for (; value >= 0x80; value >>= 7) bytes.push_back(static_cast<char>(value | 0x80));
+    bytes.push_back(static_cast<char>(value));
+  }
+
+  static size_t ReadVarint(const char*& ptr) {
+    size_t value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      const uint8_t byte = *ptr++;
+      value |= static_cast<size_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return value;
+    }
+  }
+
+  fs::path make_data_path() const {
+    return this->root_path_ / "strings";
+  }
+
+  size_t num_keys_ = 0;
+  // Page `p` holds the keys from position `page_begins_[p]` on, in bytes
+  // [page_offsets_[p], page_offsets_[p + 1]) of `data_`.
+  std::vector<size_t> page_begins_;
+  std::vector<size_t> page_offsets_;
+  mmap_struct::LazyVector<char> data_;
+  fs::path root_path_;
+
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void save(Archive & ar, const unsigned int version __attribute__((unused))) const {
+    ar << this->num_keys_;
+    ar << this->page_begins_.size();
+    ar << boost::serialization::make_array(this->page_begins_.data(), this->page_begins_.size());
+    ar << boost::serialization::make_array(this->page_offsets_.data(), this->page_offsets_.size());
+    ar << this->data_.size();  // data_size
+  }
+
+  template<class Archive>
+  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+    ar >> this->num_keys_;
+    size_t num_pages; ar >> num_pages;
+    this->page_begins_.resize(num_pages);
+    this->page_offsets_.resize(num_pages + 1);
+    ar >> boost::serialization::make_array(this->page_begins_.data(), num_pages);
+    ar >> boost::serialization::make_array(this->page_offsets_.data(), num_pages + 1);
+    size_t data_size; ar >> data_size;
+    if (data_size > 0) this->data_ = mmap_struct::LazyVector<char>(this->make_data_path(), data_size);
+  }
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+}  // namespace ts
@@ -3,11 +3,16 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <vector>
 
+#include <boost/serialization/version.hpp>
+
 #include "ts_cht/cht.h"
 #include "common.h"
+#include "key_traits.h"
 
+#include "index_file.h"
 #include "mmap_struct.h"
 
 namespace ts {
@@ -16,33 +21,205 @@ namespace ts {
 template <class KeyType>
 class TrieSpline {
  public:
+  // Keys are indexed by their encoding (see `KeyTraits`).
+  using Traits = KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+
   TrieSpline() = default;
 
   TrieSpline(fs::path root_path) : root_path_(root_path) {}
 
-  TrieSpline(KeyType min_key, KeyType max_key,
+  // With an empty `root_path`, the spline is kept in memory, e.g. to be
+  // converted into another index; it can then not be saved with boost.
+  TrieSpline(Key min_key, Key max_key,
              size_t num_keys, size_t spline_max_error,
-             ts_cht::CompactHistTree<KeyType> cht,
-             std::vector<ts::Coord<KeyType>> spline_points,
+             ts_cht::CompactHistTree<Key> cht,
+             std::vector<ts::Coord<Key>> spline_points,
+             const std::vector<std::pair<size_t, size_t>>& segment_errors,
              fs::path root_path)
       : min_key_(min_key),
         max_key_(max_key),
         num_keys_(num_keys),
         spline_max_error_(spline_max_error),
-        spline_points_(std::move(spline_points), root_path / "spline_points"),
         cht_(std::move(cht)),
-        root_path_(root_path) {}
+        root_path_(root_path) {
+    assert(segment_errors.size() == spline_points.size());
+    if (root_path.empty()) {
+      owned_points_ = std::move(spline_points);
+      spline_points_ = mmap_struct::LazyVector<ts::Coord<Key>>(owned_points_.data(), owned_points_.size());
+    } else {
+      spline_points_ = mmap_struct::LazyVector<ts::Coord<Key>>(spline_points, make_spline_points_path());
+    }
+    if (!segment_errors.empty()) {
+      std::vector<ts::SegmentBound> bounds = ts::PackSegmentBounds(segment_errors, bound_shift_);
+      if (root_path.empty()) {
+        owned_bounds_ = std::move(bounds);
+        segment_bounds_ = mmap_struct::LazyVector<ts::SegmentBound>(owned_bounds_.data(), owned_bounds_.size());
+      } else {
+        segment_bounds_ = mmap_struct::LazyVector<ts::SegmentBound>(bounds, make_segment_bounds_path());
+      }
+    }
+    Specialize();
+  }
+
+  // Maps the spline in place from `file`, without copying any component.
+  TrieSpline(const mmap_struct::IndexFile& file) : cht_(file) {
+    const auto& meta = file.GetValue<Meta>(mmap_struct::IndexFile::TrieSplineMeta);
+    min_key_ = meta.min_key;
+    max_key_ = meta.max_key;
+    num_keys_ = meta.num_keys;
+    spline_max_error_ = meta.spline_max_error;
+    bound_shift_ = meta.bound_shift;
+
+    size_t num_spline_points;
+    const auto* spline_points = file.GetArray<ts::Coord<Key>>(
+        mmap_struct::IndexFile::SplinePoints, &num_spline_points);
+    spline_points_ = mmap_struct::LazyVector<ts::Coord<Key>>(spline_points, num_spline_points);
+
+    size_t num_segment_bounds;
+    const auto* segment_bounds = file.GetArray<ts::SegmentBound>(
+        mmap_struct::IndexFile::SegmentBounds, &num_segment_bounds);
+    segment_bounds_ = mmap_struct::LazyVector<ts::SegmentBound>(segment_bounds, num_segment_bounds);
+    Specialize();
+  }
+
+  // Adds the sections of this spline (including its CHT) to `writer`.
+  void AddSections(mmap_struct::IndexFile::Writer& writer) const {
+    // Zero the padding of the meta, so that files are deterministic.
+    Meta meta;
+    memset(&meta, 0, sizeof(Meta));
+    meta.min_key = min_key_;
+    meta.max_key = max_key_;
+    meta.num_keys = num_keys_;
+    meta.spline_max_error = spline_max_error_;
+    meta.bound_shift = bound_shift_;
+    writer.AddValue(mmap_struct::IndexFile::TrieSplineMeta, meta);
+    writer.Add(mmap_struct::IndexFile::SplinePoints, spline_points_.data(),
+               spline_points_.size() * sizeof(Coord<Key>));
+    writer.Add(mmap_struct::IndexFile::SegmentBounds, segment_bounds_.data(),
+               segment_bounds_.size() * sizeof(ts::SegmentBound));
+    cht_.AddSections(writer);
+  }
 
   // Returns the estimated position of `key`.
-  double GetEstimatedPosition(const KeyType key) const {
+  double GetEstimatedPosition(const KeyType search_key) const {
+    size_t under, over;
+    return Estimate(Traits::Encode(search_key), under, over);
+  }
+
+  // Returns a search bound [begin, end) around the estimated position, from
+  // the measured errors of the spline segment of `key`.
+  ts::SearchBound GetSearchBound(const KeyType key) const {
+    size_t under, over;
+    const size_t estimate = Estimate(Traits::Encode(key), under, over);
+    const size_t begin = (estimate < over) ? 0 : (estimate - over);
+    // `end` is exclusive.
+    const size_t end = (estimate + under + 2 > num_keys_) ? num_keys_ : (estimate + under + 2);
+    return ts::SearchBound{begin, end};
+  }
+
+  /* Estimates on the index alone, without touching the data */
+
+  // Returns the rank of `key`, i.e., the number of keys less than `key`.
+  ts::CountBound EstimateRank(const KeyType search_key) const {
+    const Key key = Traits::Encode(search_key);
+    if (key <= min_key_) return ts::CountBound{0, 0, 0};
+    if (key > max_key_) return ts::CountBound{double(num_keys_), num_keys_, num_keys_};
+    const double estimate = GetEstimatedPosition(search_key);
+    const ts::SearchBound bound = GetSearchBound(search_key);
+    return ts::CountBound{std::min<double>(std::max<double>(estimate, bound.begin), bound.end),
+                          bound.begin, bound.end};
+  }
+
+  // Returns the number of keys in [lo, hi), within about
+  // 2 * `spline_max_error` of the estimate.
+  ts::CountBound EstimateRangeCount(const KeyType lo, const KeyType hi) const {
+    if (!(lo < hi)) return ts::CountBound{0, 0, 0};
+    return ts::CountBetween(EstimateRank(lo), EstimateRank(hi));
+  }
+
+  // Returns the number of keys in each bucket [boundaries[i],
+  // boundaries[i + 1]) of the sorted `boundaries`, evaluating the spline once
+  // per boundary.
+  std::vector<ts::CountBound> EstimateHistogram(const std::vector<KeyType>& boundaries) const {
+    std::vector<ts::CountBound> buckets;
+    if (boundaries.empty()) return buckets;
+    buckets.reserve(boundaries.size() - 1);
+    ts::CountBound prev = EstimateRank(boundaries.front());
+    for (size_t idx = 1; idx < boundaries.size(); ++idx) {
+      assert(!(boundaries[idx] < boundaries[idx - 1]));
+      const ts::CountBound next = EstimateRank(boundaries[idx]);
+      buckets.push_back(ts::CountBetween(prev, next));
+      prev = next;
+    }
+    return buckets;
+  }
+
+  // Returns the key at the `q`-quantile, q ∈ [0, 1], by inverting the
+  // spline: its rank is within about `spline_max_error` of q * (num_keys - 1).
+  KeyType EstimateQuantile(const double q) const {
+    const double target = std::min(std::max(q, 0.0), 1.0) * (num_keys_ - 1);
+
+    // Find spline segment with `target` ∈ (spline[index - 1].y, spline[index].y].
+    const Coord<Key>* points = spline_points_.data();
+    const size_t index =
+        std::lower_bound(points, points + spline_points_.size(), target,
+                         [](const Coord<Key>& coord, const double y) {
+                           return coord.y < y;
+                         }) - points;
+    if (index == 0) return Traits::Decode(min_key_);
+    if (index == spline_points_.size()) return Traits::Decode(max_key_);
+    const Coord<Key> down = spline_points_[index - 1];
+    const Coord<Key> up = spline_points_[index];
+
+    // Interpolate.
+    const Key x_diff = up.x - down.x;
+    const double offset = (target - down.y) / (up.y - down.y) * static_cast<double>(x_diff);
+    return Traits::Decode(down.x + std::min<Key>(static_cast<Key>(offset), x_diff));
+  }
+
+  // Returns the number of indexed keys.
+  size_t GetNumKeys() const { return num_keys_; }
+
+  // Returns the size in bytes.
+  size_t GetSize() const {
+    size_t size = sizeof(*this) + cht_.GetSize() +
+                  spline_points_.size() * sizeof(Coord<Key>) +
+                  segment_bounds_.size() * sizeof(ts::SegmentBound);
+#ifdef PLEX_FIXED_POINT_SPLINE
+    size += fixed_slopes_.size() * sizeof(ts::FixedSlope);
+#endif
+    return size;
+  }
+
+ private:
+  // Returns the estimated position of the encoded `key`, and sets `under` and
+  // `over` to the largest errors of the estimate either way.
+  double Estimate(const Key key, size_t& under, size_t& over) const {
+    under = over = spline_max_error_;
     // Truncate to data boundaries.
     if (key <= min_key_) return 0;
-    if (key >= max_key_) return num_keys_ - 1;
+    if (key > max_key_) return num_keys_ - 1;
+    // The first occurrence of `max_key_`, which may be duplicated.
+    if (key == max_key_) return spline_points_[spline_points_.size() - 1].y;
 
     // Find spline segment with `key` ∈ (spline[index - 1], spline[index]].
-    const size_t index = GetSplineSegment(key);
-    const Coord<KeyType> down = spline_points_[index - 1];
-    const Coord<KeyType> up = spline_points_[index];
+    const size_t index = spline_segment_(*this, key);
+    const ts::SegmentBound bound = segment_bounds_[index];
+    under = static_cast<size_t>(bound.under) << bound_shift_;
+    over = static_cast<size_t>(bound.over) << bound_shift_;
+    const Coord<Key> down = spline_points_[index - 1];
+    const Coord<Key> up = spline_points_[index];
+
+#ifdef PLEX_FIXED_POINT_SPLINE
+    if constexpr (sizeof(Key) <= sizeof(uint64_t)) {
+      // Interpolate in fixed point, widening the measured errors by how far
+      // its estimates may be from the floating-point ones.
+      under += ts::FixedSlope::UnderSlack;
+      over += ts::FixedSlope::OverSlack;
+      return static_cast<size_t>(down.y) + fixed_slopes_[index].Interpolate(key - down.x);
+    }
+#endif
 
     // Compute slope.
     const double x_diff = up.x - down.x;
@@ -54,92 +231,159 @@ class TrieSpline {
     return std::fma(key_diff, slope, down.y);
   }
 
-  // Returns a search bound [begin, end) around the estimated position.
-  ts::SearchBound GetSearchBound(const KeyType key) const {
-    const size_t estimate = GetEstimatedPosition(key);
-    const size_t begin =
-        (estimate < spline_max_error_) ? 0 : (estimate - spline_max_error_);
-    // `end` is exclusive.
-    const size_t end = (estimate + spline_max_error_ + 2 > num_keys_)
-                           ? num_keys_
-                           : (estimate + spline_max_error_ + 2);
-    return ts::SearchBound{begin, end};
-  }
-
-  // Returns the size in bytes.
-  size_t GetSize() const {
-    return sizeof(*this) + cht_.GetSize() +
-           spline_points_.size() * sizeof(Coord<KeyType>);
-  }
-
- private:
   // Returns the index of the spline point that marks the end of the spline
-  // segment that contains the `key`: `key` ∈ (spline[index - 1], spline[index]]
-  size_t GetSplineSegment(const KeyType key) const {
+  // segment that contains the `key`: `key` ∈ (spline[index - 1], spline[index]],
+  // with the CHT lookup `Lookup` (see `CompactHistTree::Dispatch`).
+  template <class Lookup>
+  static size_t GetSplineSegment(const TrieSpline& spline, const Key key) {
     // Narrow search range using CHT.
-    const auto range = cht_.GetSearchBound(key);
+    const auto range = Lookup()(spline.cht_, key);
+
+    // Search on raw pointers, since `LazyVector::Iterator` is not random
+    // access.
+    const Coord<Key>* points = spline.spline_points_.data();
 
     // Linear search?
     if (range.end - range.begin < 32) {
       // Do linear search over narrowed range.
-      uint32_t current = range.begin;
-      while (spline_points_[current].x < key) ++current;
+      size_t current = range.begin;
+      while (points[current].x < key) ++current;
       return current;
     }
 
     // Do binary search over narrowed range.
     const auto lb =
-        std::lower_bound(spline_points_.begin() + range.begin,
-                         spline_points_.begin() + range.end, key,
-                         [](const Coord<KeyType>& coord, const KeyType key) {
+        std::lower_bound(points + range.begin, points + range.end, key,
+                         [](const Coord<Key>& coord, const Key key) {
                            return coord.x < key;
                          });
-    return std::distance(spline_points_.begin(), lb);
+    return std::distance(points, lb);
   }
 
-  KeyType min_key_;
-  KeyType max_key_;
+  Key min_key_;
+  Key max_key_;
   size_t num_keys_;
   size_t spline_max_error_;
 
-  mmap_struct::LazyVector<ts::Coord<KeyType>> spline_points_;
-  ts_cht::CompactHistTree<KeyType> cht_;
+  mmap_struct::LazyVector<ts::Coord<Key>> spline_points_;
+  // The measured errors of each spline segment, by its last point, in units
+  // of 2^`bound_shift_`.
+  mmap_struct::LazyVector<ts::SegmentBound> segment_bounds_;
+  unsigned bound_shift_ = 0;
+  // Back `spline_points_` and `segment_bounds_` when they are not in files:
+  // for splines kept in memory, or saved without segment bounds.
+  std::vector<ts::Coord<Key>> owned_points_;
+  std::vector<ts::SegmentBound> owned_bounds_;
+  ts_cht::CompactHistTree<Key> cht_;
+  // `GetSplineSegment` with the lookup of `cht_`, set by `Specialize`.
+  size_t (*spline_segment_)(const TrieSpline&, Key) = nullptr;
+#ifdef PLEX_FIXED_POINT_SPLINE
+  // The slope of each spline segment, by its last point, set by `Specialize`.
+  std::vector<ts::FixedSlope> fixed_slopes_;
+#endif
 
   fs::path root_path_;
 
+  // Scalar members, as stored in an index file.
+  struct Meta {
+    Key min_key;
+    Key max_key;
+    size_t num_keys;
+    size_t spline_max_error;
+    size_t bound_shift;
+  };
+
+  template <typename>
+  friend class CompactTrieSpline;
+  template <typename>
+  friend class CodeGenerator;
+  template <typename>
+  friend class GeneratedTrieSpline;
+  template <typename>
+  friend class TrieSpline32;
+
+  // Picks the instantiation of `GetSplineSegment` for the layout of `cht_`,
+  // and precomputes the fixed-point slopes of the segments.
+  void Specialize() {
+    spline_segment_ = cht_.Dispatch([](auto lookup) { return &GetSplineSegment<decltype(lookup)>; });
+#ifdef PLEX_FIXED_POINT_SPLINE
+    if constexpr (sizeof(Key) <= sizeof(uint64_t)) {
+      fixed_slopes_.assign(spline_points_.size(), ts::FixedSlope());
+      for (size_t idx = 1; idx < spline_points_.size(); ++idx) {
+        const Coord<Key> down = spline_points_[idx - 1];
+        const Coord<Key> up = spline_points_[idx];
+        fixed_slopes_[idx] = ts::FixedSlope(up.x - down.x, up.y - down.y);
+      }
+    }
+#endif
+  }
 
   fs::path make_spline_points_path() const {
     return this->root_path_ / "spline_points";
   }
 
+  fs::path make_segment_bounds_path() const {
+    return this->root_path_ / "segment_bounds";
+  }
+
   /* Serialization */
 
   friend class boost::serialization::access;
   template<class Archive>
   void save(Archive & ar, const unsigned int version __attribute__((unused))) const {
     // std::cout << "TrieSpline::save" << std::endl;
-    ar << this->min_key_;
-    ar << this->max_key_;
+    SerializeKey(ar, const_cast<Key&>(this->min_key_));
+    SerializeKey(ar, const_cast<Key&>(this->max_key_));
     ar << this->num_keys_;
     ar << this->spline_max_error_;
     ar << this->cht_;
 
     ar << this->spline_points_.size();  // data_size
+    ar << this->bound_shift_;
   }
 
   template<class Archive>
-  void load(Archive & ar, const unsigned int version __attribute__((unused))) {
+  void load(Archive & ar, const unsigned int version) {
     // std::cout << "TrieSpline::load" << std::endl;
-    ar >> this->min_key_;
-    ar >> this->max_key_;
+    SerializeKey(ar, this->min_key_);
+    SerializeKey(ar, this->max_key_);
     ar >> this->num_keys_;
     ar >> this->spline_max_error_;
     ar >> this->cht_;
 
     size_t data_size; ar >> data_size;
-    this->spline_points_ = mmap_struct::LazyVector<ts::Coord<KeyType>>(this->make_spline_points_path(), data_size);
+    this->spline_points_ = mmap_struct::LazyVector<ts::Coord<Key>>(this->make_spline_points_path(), data_size);
+
+    if (version >= 1) {
+      ar >> this->bound_shift_;
+      if (data_size > 0) {
+        this->segment_bounds_ = mmap_struct::LazyVector<ts::SegmentBound>(this->make_segment_bounds_path(), data_size);
+      }
+    } else if (data_size > 0) {
+      // Saved without segment bounds: every segment has `spline_max_error_`.
+      this->owned_bounds_ = ts::PackSegmentBounds(
+          std::vector<std::pair<size_t, size_t>>(data_size, {spline_max_error_, spline_max_error_}),
+          this->bound_shift_);
+      this->segment_bounds_ = mmap_struct::LazyVector<ts::SegmentBound>(this->owned_bounds_.data(),
+                                                                        this->owned_bounds_.size());
+    }
+    Specialize();
   }
   BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
 
 }  // namespace ts
+
+namespace boost {
+namespace serialization {
+
+// Version 1: the measured errors of the spline segments.
+template <class KeyType>
+struct version<ts::TrieSpline<KeyType>> {
+  typedef mpl::integral_c_tag tag;
+  typedef mpl::int_<1> type;
+  BOOST_STATIC_CONSTANT(int, value = 1);
+};
+
+}  // namespace serialization
+}  // namespace boost
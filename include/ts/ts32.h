@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <boost/serialization/array_wrapper.hpp>
+
+#include "ts_cht/cht.h"
+#include "common.h"
+#include "key_traits.h"
+#include "ts.h"
+
+namespace ts {
+
+// A built `TrieSpline` over 32-bit keys and fewer than 2^32 keys, with 32-bit
+// scalars and 12-byte spline points instead of 16 (plus 4 for their segment
+// bounds): positions are stored as 32-bit integer ranks, which they are, and
+// each point keeps the bound of its segment next to it, so that a lookup reads
+// a single array. Search bounds are the same as the spline's.
+template <class KeyType>
+class TrieSpline32 {
+ public:
+  using Traits = KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+  static_assert(sizeof(Key) == sizeof(uint32_t), "TrieSpline32: keys of other than 32 bits");
+
+  TrieSpline32() = default;
+
+  TrieSpline32(fs::path root_path __attribute__((unused))) {}
+
+  explicit TrieSpline32(TrieSpline<KeyType>&& ts)
+      : min_key_(ts.min_key_),
+        max_key_(ts.max_key_),
+        num_keys_(static_cast<uint32_t>(ts.num_keys_)),
+        spline_max_error_(static_cast<uint32_t>(ts.spline_max_error_)),
+        bound_shift_(ts.bound_shift_),
+        cht_(std::move(ts.cht_)) {
+    if (ts.num_keys_ > std::numeric_limits<uint32_t>::max() ||
+        ts.spline_max_error_ > std::numeric_limits<uint32_t>::max()) {
+      std::cerr << "TrieSpline32 indexes fewer than 2^32 keys, with errors below 2^32" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    points_.resize(ts.spline_points_.size());
+    for (size_t idx = 0; idx < points_.size(); ++idx) {
+      const Coord<Key> point = ts.spline_points_[idx];
+      assert(point.y == std::floor(point.y));
+      points_[idx] = Point{point.x, static_cast<uint32_t>(point.y), ts.segment_bounds_[idx]};
+    }
+    PrecomputeSlopes();
+  }
+
+  // Returns the estimated position of `key`.
+  double GetEstimatedPosition(const KeyType search_key) const {
+    size_t under, over;
+    return Estimate(Traits::Encode(search_key), under, over);
+  }
+
+  // Returns a search bound [begin, end) around the estimated position, from
+  // the measured errors of the spline segment of `key`.
+  ts::SearchBound GetSearchBound(const KeyType key) const {
+    size_t under, over;
+    const size_t estimate = Estimate(Traits::Encode(key), under, over);
+    const size_t begin = (estimate < over) ? 0 : (estimate - over);
+    // `end` is exclusive.
+    const size_t end = (estimate + under + 2 > num_keys_) ? num_keys_ : (estimate + under + 2);
+    return ts::SearchBound{begin, end};
+  }
+
+  // Returns the number of indexed keys.
+  size_t GetNumKeys() const { return num_keys_; }
+
+  // Returns the size in bytes.
+  size_t GetSize() const {
+    size_t size = sizeof(*this) + points_.size() * sizeof(Point) + cht_.GetSize();
+#ifdef PLEX_FIXED_POINT_SPLINE
+    size += fixed_slopes_.size() * sizeof(ts::FixedSlope32);
+#endif
+    return size;
+  }
+
+ private:
+  // A spline point, with the measured errors of the segment it ends.
+  struct Point {
+    Key x;
+    uint32_t y;
+    ts::SegmentBound bound;
+  };
+  static_assert(sizeof(Point) == 12, "TrieSpline32: padded spline points");
+
+  // Returns the estimated position of the encoded `key`, and sets `under` and
+  // `over` to the largest errors of the estimate either way.
+  double Estimate(const Key key, size_t& under, size_t& over) const {
+    under = over = spline_max_error_;
+    // Truncate to data boundaries.
+    if (key <= min_key_) return 0;
+    if (key > max_key_) return num_keys_ - 1;
+    // The first occurrence of `max_key_`, which may be duplicated.
+    if (key == max_key_) return points_.back().y;
+
+    // Find spline segment with `key` ∈ (spline[index - 1], spline[index]].
+    const size_t index = GetSplineSegment(key);
+    const Point& down = points_[index - 1];
+    const Point& up = points_[index];
+    under = static_cast<size_t>(up.bound.under) << bound_shift_;
+    over = static_cast<size_t>(up.bound.over) << bound_shift_;
+
+#ifdef PLEX_FIXED_POINT_SPLINE
+    // As `TrieSpline::Estimate`.
+    under += ts::FixedSlope32::UnderSlack;
+    over += ts::FixedSlope32::OverSlack;
+    return down.y + fixed_slopes_[index].Interpolate(key - down.x);
+#endif
+
+    // Compute slope.
+    const double x_diff = up.x - down.x;
+    const double y_diff = static_cast<double>(up.y) - down.y;
+    const double slope = y_diff / x_diff;
+
+    // Interpolate.
+    const double key_diff = key - down.x;
+    return std::fma(key_diff, slope, down.y);
+  }
+
+  // Precomputes the fixed-point slopes of the segments, with
+  // PLEX_FIXED_POINT_SPLINE.
+  void PrecomputeSlopes() {
+#ifdef PLEX_FIXED_POINT_SPLINE
+    fixed_slopes_.assign(points_.size(), ts::FixedSlope32());
+    for (size_t idx = 1; idx < points_.size(); ++idx) {
+      fixed_slopes_[idx] = ts::FixedSlope32(points_[idx].x - points_[idx - 1].x,
+                                          points_[idx].y - points_[idx - 1].y);
+    }
+#endif
+  }
+
+  // Returns the index of the spline point that marks the end of the spline
+  // segment that contains the `key`: `key` ∈ (spline[index - 1], spline[index]]
+  size_t GetSplineSegment(const Key key) const {
+    // Narrow search range using CHT.
+    const auto range = cht_.GetSearchBound(key);
+
+    // Linear search?
+    if (range.end - range.begin < 32) {
+      // Do linear search over narrowed range.
+      size_t current = range.begin;
+      while (points_[current].x < key) ++current;
+      return current;
+    }
+
+    // Do binary search over narrowed range.
+    const auto lb = std::lower_bound(points_.begin() + range.begin, points_.begin() + range.end, key,
+                                     [](const Point& point, const Key key) {
+                                       return point.x < key;
+                                     });
+    return std::distance(points_.begin(), lb);
+  }
+
+  Key min_key_;
+  Key max_key_;
+  uint32_t num_keys_;
+  uint32_t spline_max_error_;
+  unsigned bound_shift_;
+
+  std::vector<Point> points_;
+  ts_cht::CompactHistTree<Key> cht_;
+#ifdef PLEX_FIXED_POINT_SPLINE
+  // The slope of each spline segment, by its last point.
+  std::vector<ts::FixedSlope32> fixed_slopes_;
+#endif
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive & ar, const unsigned int version __attribute__((unused))) {
+    ar & this->min_key_;
+    ar & this->max_key_;
+    ar & this->num_keys_;
+    ar & this->spline_max_error_;
+    ar & this->bound_shift_;
+    size_t num_points = this->points_.size();
+    ar & num_points;
+    this->points_.resize(num_points);
+    ar & boost::serialization::make_array(reinterpret_cast<char*>(this->points_.data()),
+                                          this->points_.size() * sizeof(Point));
+    ar & this->cht_;
+    if (Archive::is_loading::value) PrecomputeSlopes();
+  }
+};
+
+}  // namespace ts
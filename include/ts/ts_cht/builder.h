@@ -7,20 +7,48 @@
 #include "cht.h"
 #include "common.h"
 
+#include "../key_traits.h"
+
 namespace ts_cht {
 
+// A non-owning view of keys stored `stride` bytes apart, e.g. the `x` of an
+// array of spline points.
+template <class KeyType>
+class KeyView {
+ public:
+  KeyView() : data_(nullptr), size_(0), stride_(sizeof(KeyType)) {}
+
+  KeyView(const KeyType* data, size_t size, size_t stride = sizeof(KeyType))
+      : data_(reinterpret_cast<const char*>(data)), size_(size), stride_(stride) {}
+
+  KeyType operator[](size_t index) const {
+    return *reinterpret_cast<const KeyType*>(data_ + index * stride_);
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t stride_;
+};
+
 // Build a `CompactHistTree`.
 template <class KeyType>
 class Builder {
  public:
+  using Traits = ts::KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+
   Builder(KeyType min_key, KeyType max_key)
-      : min_key_(min_key),
-        max_key_(max_key),
+      : min_key_(Traits::Encode(min_key)),
+        max_key_(Traits::Encode(max_key)),
         curr_num_keys_(0),
-        prev_key_(min_key) {}
+        prev_key_(min_key_) {}
 
   // Adds a key. Assumes that keys are stored in a dense array.
-  void AddKey(KeyType key) {
+  void AddKey(KeyType search_key) {
+    const Key key = Traits::Encode(search_key);
     assert(key >= min_key_ && key <= max_key_);
     // Keys need to be monotonically increasing.
     assert(key >= prev_key_);
@@ -32,18 +60,30 @@ class Builder {
     prev_key_ = key;
   }
 
-  // Finalizes the construction and returns a read-only `RadixSpline`.
+  // Finalizes the construction over the keys added with `AddKey` and returns
+  // a read-only `CompactHistTree`.
   CompactHistTree<KeyType> Finalize(size_t num_bins, size_t max_error) {
     // Last key needs to be equal to `max_key_`.
     assert((!curr_num_keys_) || (prev_key_ == max_key_));
+    return Finalize(num_bins, max_error, KeyView<Key>(keys_.data(), keys_.size()));
+  }
+
+  // Finalizes the construction over the encoded `keys`, which are read in
+  // place instead of being added with `AddKey`. They must be sorted and end
+  // with `max_key_`.
+  CompactHistTree<KeyType> Finalize(size_t num_bins, size_t max_error, KeyView<Key> keys) {
+    assert(keys.size() == 0 || keys[keys.size() - 1] == max_key_);
+    keys_view_ = keys;
+    curr_num_keys_ = keys.size();
 
     // Set the parameters.
     num_bins_ = num_bins;
     max_error_ = max_error;
     log_num_bins_ = ComputeLog(static_cast<uint64_t>(num_bins_));
 
-    // Compute the logarithm in base 2 of the range.
-    auto lg = ComputeLog(max_key_ - min_key_, true);
+    // Compute the number of bits of the range (one more than the rounded
+    // logarithm if the range is a power of two).
+    auto lg = ComputeLog(max_key_ - min_key_) + 1;
 
     // And also the initial shift for the first node of the tree.
     assert(lg >= log_num_bins_);
@@ -58,63 +98,78 @@ class Builder {
     // Flatten directly falls back to a radix table, in case CHT contains only one node.
     bool single_layer = Flatten();
 
-    // And return the adaptive CHT.
+    // And return the adaptive CHT, with 64-bit entries only if needed.
+    using Narrow = TableEntry<unsigned>;
+    if (curr_num_keys_ > Narrow::Mask || nodes_.size() > Narrow::Mask) {
+      return CompactHistTree<KeyType>(single_layer, min_key_, max_key_, curr_num_keys_,
+                                      num_bins_, log_num_bins_, max_error_,
+                                      shift_, std::move(table_));
+    }
+    std::vector<unsigned> narrow_table(table_.size());
+    for (size_t index = 0; index != table_.size(); ++index) {
+      narrow_table[index] = (table_[index] & Leaf) ? ((table_[index] & Mask) | Narrow::Leaf)
+                                                   : table_[index];
+    }
     return CompactHistTree<KeyType>(single_layer, min_key_, max_key_, curr_num_keys_,
                                     num_bins_, log_num_bins_, max_error_,
-                                    shift_, std::move(table_));
+                                    shift_, std::move(narrow_table));
   }
 
  private:
   static constexpr unsigned Infinity = std::numeric_limits<unsigned>::max();
-  static constexpr unsigned Leaf = (1u << 31);
-  static constexpr unsigned Mask = Leaf - 1;
+  // The tree is built with 64-bit entries, narrowed in `Finalize` if possible.
+  static constexpr uint64_t Leaf = TableEntry<uint64_t>::Leaf;
+  static constexpr uint64_t Mask = TableEntry<uint64_t>::Mask;
 
   // Range covered by a node, i.e. [l, r[
-  using Range = std::pair<unsigned, unsigned>;
+  using Range = std::pair<size_t, size_t>;
 
   // (Node level, smallest key in node)
-  using Info = std::pair<unsigned, KeyType>;
+  using Info = std::pair<unsigned, Key>;
 
   // A queue element
   using Elem = std::pair<unsigned, Range>;
 
-  static unsigned ComputeLog(uint32_t n, bool round = false) {
+  // For `uint32_t`, `uint64_t` and `__uint128_t`.
+  template <class T>
+  static unsigned ComputeLog(T n, bool round = false) {
     assert(n);
-    return 31 - __builtin_clz(n) + (round ? ((n & (n - 1)) != 0) : 0);
+    return sizeof(T) * 8 - 1 - ts::CountLeadingZeros(n) + (round ? ((n & (n - 1)) != 0) : 0);
   }
 
-  static unsigned ComputeLog(uint64_t n, bool round = false) {
-    assert(n);
-    return 63 - __builtin_clzl(n) + (round ? ((n & (n - 1)) != 0) : 0);
+  // Returns the number of shift bits based on the `diff` between the largest
+  // and the smallest key.
+  static size_t GetNumShiftBits(Key diff, size_t num_radix_bits) {
+    const size_t num_bits = sizeof(Key) * 8 - ts::CountLeadingZeros(diff);
+    if (num_bits < num_radix_bits) return 0;
+    return num_bits - num_radix_bits;
   }
 
-  // Returns the number of shift bits based on the `diff` between the largest
-  // and the smallest key. KeyType == uint32_t.
-  static size_t GetNumShiftBits(uint32_t diff, size_t num_radix_bits) {
-    const uint32_t clz = __builtin_clz(diff);
-    if ((32 - clz) < num_radix_bits) return 0;
-    return 32 - num_radix_bits - clz;
+  // Appends a node with `info` to the tree, with all bins set to the empty
+  // range at `end`.
+  void AddNode(Info info, size_t end) {
+    nodes_.push_back(info);
+    bins_.resize(bins_.size() + num_bins_, {end, end});
   }
-  // KeyType == uint64_t.
-  static size_t GetNumShiftBits(uint64_t diff, size_t num_radix_bits) {
-    const uint32_t clzl = __builtin_clzl(diff);
-    if ((64 - clzl) < num_radix_bits) return 0;
-    return 64 - num_radix_bits - clzl;
+
+  // Returns the range of `bin` in `node`.
+  Range& Bin(size_t node, size_t bin) {
+    return bins_[(node << log_num_bins_) + bin];
   }
 
   void BuildOffline() {
     // Init the node, which covers the range `curr` := [a, b[.
-    auto initNode = [&](unsigned nodeIndex, Range curr) -> void {
+    auto initNode = [&](size_t nodeIndex, Range curr) -> void {
       // Compute `width` of the current node (2^`width` represents the range
       // covered by a single bin).
       std::optional<unsigned> currBin = std::nullopt;
-      unsigned width = shift_ - tree_[nodeIndex].first.first * log_num_bins_;
+      unsigned width = shift_ - nodes_[nodeIndex].first * log_num_bins_;
 
       // And compute the bins
-      for (unsigned index = curr.first; index != curr.second; ++index) {
+      for (size_t index = curr.first; index != curr.second; ++index) {
         // Extract the bin of the current key.
         auto bin =
-            (keys_[index] - min_key_ - tree_[nodeIndex].first.second) >> width;
+            (keys_view_[index] - min_key_ - nodes_[nodeIndex].second) >> width;
 
         // Is the first bin or a new one?
         if ((!currBin.has_value()) || (bin != currBin.value())) {
@@ -122,28 +177,26 @@ class Builder {
           // empty range.
           for (unsigned iter = currBin.has_value() ? (currBin.value() + 1) : 0;
                iter != bin; ++iter) {
-            tree_[nodeIndex].second[iter] = {index, index};
+            Bin(nodeIndex, iter) = {index, index};
           }
 
           // Init the current bin.
-          tree_[nodeIndex].second[bin] = {index, index};
+          Bin(nodeIndex, bin) = {index, index};
           currBin = bin;
         }
 
         // And increase the range of the current bin.
-        tree_[nodeIndex].second[bin].second++;
+        Bin(nodeIndex, bin).second++;
       }
-      assert(tree_[nodeIndex].second[currBin.value()].second == curr.second);
+      assert(Bin(nodeIndex, currBin.value()).second == curr.second);
     };
 
     // Init the first node.
-    tree_.push_back(
-        {{0, 0},
-         std::vector<Range>(num_bins_, {curr_num_keys_, curr_num_keys_})});
+    AddNode({0, 0}, curr_num_keys_);
     initNode(0, {0, curr_num_keys_});
 
     // Run the BFS
-    std::queue<unsigned> nodes;
+    std::queue<size_t> nodes;
     nodes.push(0);
     while (!nodes.empty()) {
       // Extract from the queue.
@@ -151,42 +204,36 @@ class Builder {
       nodes.pop();
 
       // Consider each bin and decide whether we should split it.
-      unsigned level = tree_[node].first.first;
-      KeyType lower = tree_[node].first.second;
+      unsigned level = nodes_[node].first;
+      Key lower = nodes_[node].second;
       for (unsigned bin = 0; bin != num_bins_; ++bin) {
         // Should we split further?
-        if (tree_[node].second[bin].second - tree_[node].second[bin].first >
-            max_error_) {
+        if (Bin(node, bin).second - Bin(node, bin).first > max_error_) {
           // Corner-case: is #keys > range? Then create a leaf (this can only
           // happen for datasets with duplicates).
-          auto size =
-              tree_[node].second[bin].second - tree_[node].second[bin].first;
-          if (size > (1ull << (shift_ - level * log_num_bins_))) {
-            tree_[node].second[bin].first |= Leaf;
+          auto size = Bin(node, bin).second - Bin(node, bin).first;
+          if (size > (Key(1) << (shift_ - level * log_num_bins_))) {
+            Bin(node, bin).first |= Leaf;
             continue;
           }
 
-          // Alloc the next node.
-          std::vector<Range> newNode;
-          newNode.assign(num_bins_, {tree_[node].second[bin].second,
-                                     tree_[node].second[bin].second});
-
-          // And add it to the tree.
+          // Alloc the next node and add it to the tree.
           auto newLower =
-              lower + bin * (1ull << (shift_ - level * log_num_bins_));
-          tree_.push_back({{level + 1, newLower}, newNode});
+              lower + bin * (Key(1) << (shift_ - level * log_num_bins_));
+          const Range range = Bin(node, bin);
+          AddNode({level + 1, newLower}, range.second);
 
           // Init it
-          initNode(tree_.size() - 1, tree_[node].second[bin]);
+          initNode(nodes_.size() - 1, range);
 
           // Reset this node (no leaf, pointer to child).
-          tree_[node].second[bin] = {0, tree_.size() - 1};
+          Bin(node, bin) = {0, nodes_.size() - 1};
 
           // And push it into the queue.
-          nodes.push(tree_.size() - 1);
+          nodes.push(nodes_.size() - 1);
         } else {
           // Leaf
-          tree_[node].second[bin].first |= Leaf;
+          Bin(node, bin).first |= Leaf;
         }
       }
     }
@@ -195,23 +242,23 @@ class Builder {
   // Flatten the layout of the tree.
   bool Flatten() {    
     // Transform into radix table if there is only one node.
-    if (tree_.size() == 1) {
+    if (nodes_.size() == 1) {
       TransformIntoRadixTable();
       return true;
     }
 
-    table_.resize(static_cast<size_t>(tree_.size()) * num_bins_);
-    for (size_t index = 0, limit = tree_.size(); index != limit; ++index) {
+    table_.resize(static_cast<size_t>(nodes_.size()) * num_bins_);
+    for (size_t index = 0, limit = nodes_.size(); index != limit; ++index) {
       for (unsigned bin = 0; bin != num_bins_; ++bin) {
         // Leaf node?
-        if (tree_[index].second[bin].first & Leaf) {
+        if (Bin(index, bin).first & Leaf) {
           // Set the partial sum.
           table_[(index << log_num_bins_) + bin] =
-              tree_[index].second[bin].first;
+              Bin(index, bin).first;
         } else {
           // Set the pointer.
           table_[(index << log_num_bins_) + bin] =
-              tree_[index].second[bin].second;
+              Bin(index, bin).second;
         }
       }
     }
@@ -222,22 +269,24 @@ class Builder {
   // cache-oblivious.
   bool CacheObliviousFlatten() {
     // Build the precendence graph between nodes.
-    assert(!tree_.empty());
+    assert(!nodes_.empty());
     
     // Transform into radix table if there is only one node.
-    if (tree_.size() == 1) {
+    if (nodes_.size() == 1) {
       TransformIntoRadixTable();
       return true;
     }
 
-    auto maxLevel = tree_.back().first.first;
-    std::vector<std::vector<unsigned>> graph(tree_.size());
-    for (unsigned index = 0, limit = tree_.size(); index != limit; ++index) {
+    // Node indices are 32-bit in the helper structures below.
+    assert(nodes_.size() < Infinity);
+    auto maxLevel = nodes_.back().first;
+    std::vector<std::vector<unsigned>> graph(nodes_.size());
+    for (unsigned index = 0, limit = nodes_.size(); index != limit; ++index) {
       graph[index].reserve(num_bins_);
       for (unsigned bin = 0; bin != num_bins_; ++bin) {
         // No leaf?
-        if ((tree_[index].second[bin].first & Leaf) == 0) {
-          graph[index].push_back(tree_[index].second[bin].second);
+        if ((Bin(index, bin).first & Leaf) == 0) {
+          graph[index].push_back(Bin(index, bin).second);
         }
       }
     }
@@ -249,10 +298,10 @@ class Builder {
     };
 
     std::vector<std::pair<unsigned, unsigned>> helper(
-        static_cast<size_t>(tree_.size()) * (maxLevel + 1), {Infinity, 0});
-    for (unsigned index = 0, limit = tree_.size(); index != limit; ++index) {
+        static_cast<size_t>(nodes_.size()) * (maxLevel + 1), {Infinity, 0});
+    for (unsigned index = 0, limit = nodes_.size(); index != limit; ++index) {
       auto vertex = limit - index - 1;
-      const auto currLvl = tree_[vertex].first.first;
+      const auto currLvl = nodes_[vertex].first;
 
       // Add the vertex itself.
       helper[access(vertex) + currLvl] = {vertex, 1};
@@ -270,7 +319,7 @@ class Builder {
 
     // Build the `order`, the cache-oblivious permutation.
     unsigned tempSize = 0;
-    std::vector<unsigned> order(tree_.size());
+    std::vector<unsigned> order(nodes_.size());
 
     // Fill levels in [`lh`, `uh`[.
     std::function<void(unsigned, unsigned, unsigned)> fill =
@@ -313,18 +362,18 @@ class Builder {
     fill(0, 0, maxLevel + 1);
 
     // Flatten with `order`.
-    table_.resize(static_cast<size_t>(tree_.size()) * num_bins_);
-    for (unsigned index = 0, limit = tree_.size(); index != limit; ++index) {
+    table_.resize(static_cast<size_t>(nodes_.size()) * num_bins_);
+    for (unsigned index = 0, limit = nodes_.size(); index != limit; ++index) {
       for (unsigned bin = 0; bin != num_bins_; ++bin) {
         // Leaf node?
-        if (tree_[index].second[bin].first & Leaf) {
+        if (Bin(index, bin).first & Leaf) {
           // Set the partial sum.
           table_[(static_cast<size_t>(order[index]) << log_num_bins_) + bin] =
-              tree_[index].second[bin].first;
+              Bin(index, bin).first;
         } else {
           // Set the pointer.
           table_[(static_cast<size_t>(order[index]) << log_num_bins_) + bin] =
-              order[tree_[index].second[bin].second];
+              order[Bin(index, bin).second];
         }
       }
     }
@@ -337,33 +386,39 @@ class Builder {
 
   // Transform a single-node tree into a radix table.
   void TransformIntoRadixTable() {
-    assert(tree_.size() == 1);
+    assert(nodes_.size() == 1);
     num_radix_bits_ = log_num_bins_;
     num_shift_bits_ = GetNumShiftBits(max_key_ - min_key_, num_radix_bits_);
     const uint32_t max_prefix = (max_key_ - min_key_) >> num_shift_bits_;
     table_.resize(max_prefix + 2, 0);
     for (size_t index = 0, limit = std::min(num_bins_, table_.size()); index != limit; ++index)
-      table_[index] = (tree_.front().second[index].first & Mask);
+      table_[index] = (Bin(0, index).first & Mask);
     table_.back() = curr_num_keys_;
     shift_ = num_shift_bits_;
   }
 
-  const KeyType min_key_;
-  const KeyType max_key_;
+  const Key min_key_;
+  const Key max_key_;
   size_t num_bins_;
   size_t log_num_bins_;
   size_t max_error_;
   
   size_t curr_num_keys_;
-  KeyType prev_key_;
+  Key prev_key_;
   size_t shift_;
 
   size_t num_radix_bits_;
   size_t num_shift_bits_;
 
-  std::vector<KeyType> keys_;
-  std::vector<unsigned> table_;
-  std::vector<std::pair<Info, std::vector<Range>>> tree_;
+  // Keys added with `AddKey`; `keys_view_` is what the tree is built over.
+  std::vector<Key> keys_;
+  KeyView<Key> keys_view_;
+  std::vector<uint64_t> table_;
+
+  // The tree: node `i` has info `nodes_[i]` and its bins in a single arena,
+  // at `bins_[i * num_bins_, (i + 1) * num_bins_)`.
+  std::vector<Info> nodes_;
+  std::vector<Range> bins_;
 };
 
 }  // namespace cht
@@ -2,22 +2,38 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <optional>
 #include <queue>
+#include <utility>
 #include <vector>
 
+#include <boost/serialization/version.hpp>
+
 #include "common.h"
 
+#include "../index_file.h"
+#include "../key_traits.h"
 #include "../mmap_struct.h"
 
+namespace ts {
+template <class> class CodeGenerator;
+template <class> class GeneratedTrieSpline;
+}  // namespace ts
+
 namespace ts_cht {
 
 template <class KeyType>
 class CompactHistTree {
  public:
+  // Keys are indexed by their encoding (see `ts::KeyTraits`).
+  using Traits = ts::KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+
   CompactHistTree() = default;
 
-  CompactHistTree(bool single_layer, KeyType min_key, KeyType max_key, size_t num_keys,
+  CompactHistTree(bool single_layer, Key min_key, Key max_key, size_t num_keys,
                   size_t num_bins, size_t log_num_bins, size_t max_error,
                   size_t shift, std::vector<unsigned> table)
       : single_layer_(single_layer),
@@ -28,44 +44,249 @@ class CompactHistTree {
         log_num_bins_(log_num_bins),
         max_error_(max_error),
         shift_(shift),
-        table_(std::move(table)) {}
+        table_(std::move(table)),
+        table_data_(table_.data()),
+        table_size_(table_.size()) {
+    Specialize();
+  }
+
+  // A tree with 64-bit table entries, for more than 2^31 keys or nodes.
+  CompactHistTree(bool single_layer, Key min_key, Key max_key, size_t num_keys,
+                  size_t num_bins, size_t log_num_bins, size_t max_error,
+                  size_t shift, std::vector<uint64_t> table)
+      : single_layer_(single_layer),
+        min_key_(min_key),
+        max_key_(max_key),
+        num_keys_(num_keys),
+        num_bins_(num_bins),
+        log_num_bins_(log_num_bins),
+        max_error_(max_error),
+        shift_(shift),
+        wide_(true),
+        wide_table_(std::move(table)),
+        wide_table_data_(wide_table_.data()),
+        table_size_(wide_table_.size()) {
+    Specialize();
+  }
+
+  CompactHistTree(const CompactHistTree& other) = delete;
+  CompactHistTree(CompactHistTree&& other) = default;
+  CompactHistTree& operator=(const CompactHistTree& other) = delete;
+  CompactHistTree& operator=(CompactHistTree&& other) = default;
+
+  // Maps the tree in place from `file`, without copying the table.
+  CompactHistTree(const mmap_struct::IndexFile& file) {
+    const auto& meta = file.GetValue<Meta>(mmap_struct::IndexFile::CHTMeta);
+    single_layer_ = meta.single_layer;
+    min_key_ = meta.min_key;
+    max_key_ = meta.max_key;
+    num_keys_ = meta.num_keys;
+    num_bins_ = meta.num_bins;
+    log_num_bins_ = meta.log_num_bins;
+    max_error_ = meta.max_error;
+    shift_ = meta.shift;
+    wide_ = meta.wide;
+    if (wide_) {
+      wide_table_data_ = file.GetArray<uint64_t>(mmap_struct::IndexFile::CHTTable, &table_size_);
+    } else {
+      table_data_ = file.GetArray<unsigned>(mmap_struct::IndexFile::CHTTable, &table_size_);
+    }
+    Specialize();
+  }
+
+  // Adds the sections of this tree to `writer`.
+  void AddSections(mmap_struct::IndexFile::Writer& writer) const {
+    // Zero the padding of the meta, so that files are deterministic.
+    Meta meta;
+    memset(&meta, 0, sizeof(Meta));
+    meta.single_layer = single_layer_;
+    meta.min_key = min_key_;
+    meta.max_key = max_key_;
+    meta.num_keys = num_keys_;
+    meta.num_bins = num_bins_;
+    meta.log_num_bins = log_num_bins_;
+    meta.max_error = max_error_;
+    meta.shift = shift_;
+    meta.wide = wide_;
+    writer.AddValue(mmap_struct::IndexFile::CHTMeta, meta);
+    if (wide_) {
+      writer.Add(mmap_struct::IndexFile::CHTTable, wide_table_data_,
+                 table_size_ * sizeof(uint64_t));
+    } else {
+      writer.Add(mmap_struct::IndexFile::CHTTable, table_data_, table_size_ * sizeof(unsigned));
+    }
+  }
 
   // Returns a search bound [`begin`, `end`) around the estimated position.
-  SearchBound GetSearchBound(const KeyType key) const {
+  SearchBound GetSearchBound(const KeyType search_key) const {
+    return search_bound_(*this, Traits::Encode(search_key));
+  }
+
+  // Calls `f` with the lookup specialised on the layout of this tree, a
+  // function object with `SearchBound operator()(const CompactHistTree&, Key)`
+  // on encoded keys, and returns its result. Callers pick the instantiation of
+  // their hot path once, e.g. as a function pointer, instead of branching on
+  // the layout for every key. Trees with narrow entries and up to
+  // 2^`MaxSpecialisedLogNumBins` bins per node, which covers the tuned
+  // configurations, have an unrolled descent; other trees fall back to the
+  // generic loop.
+  template <class F>
+  auto Dispatch(F&& f) const {
+    if (single_layer_) {
+      if (wide_) return f(RadixLookup<uint64_t>());
+      return f(RadixLookup<unsigned>());
+    }
+    if (wide_) return f(GenericLookup());
+    return DispatchTree<1>(f);
+  }
+
+  static constexpr size_t MaxSpecialisedLogNumBins = 20;
+
+  // Returns the size in bytes.
+  size_t GetSize() const {
+    return sizeof(*this) + table_size_ * (wide_ ? sizeof(uint64_t) : sizeof(unsigned));
+  }
+
+ private:
+  // Returns entry `idx` of the table, without the leaf flag, and whether it
+  // is a leaf.
+  std::pair<uint64_t, bool> GetEntry(size_t idx) const {
+    if (wide_) {
+      using Entry = TableEntry<uint64_t>;
+      return {wide_table_data_[idx] & Entry::Mask, (wide_table_data_[idx] & Entry::Leaf) != 0};
+    }
+    using Entry = TableEntry<unsigned>;
+    return {table_data_[idx] & Entry::Mask, (table_data_[idx] & Entry::Leaf) != 0};
+  }
+
+  template <class Entry>
+  SearchBound GetSearchBound(const Key key, const Entry* table) const {
     if (!single_layer_) {
-      const size_t begin = Lookup(key);
+      const size_t begin = Lookup(key, table);
       // `end` is exclusive.
       const size_t end = (begin + max_error_ + 1 > num_keys_)
                             ? num_keys_
                             : (begin + max_error_ + 1);
       return SearchBound{begin, end};
     } else {
-      const KeyType prefix = (key - min_key_) >> shift_;
-      assert(prefix + 1 < table_.size());
-      const uint32_t begin = table_[prefix];
-      const uint32_t end = table_[prefix + 1];
+      const Key prefix = (key - min_key_) >> shift_;
+      assert(prefix + 1 < table_size_);
+      const size_t begin = table[prefix];
+      const size_t end = table[prefix + 1];
       return SearchBound{begin, end};
     }
   }
 
-  // Returns the size in bytes.
-  size_t GetSize() const {
-    return sizeof(*this) + table_.size() * sizeof(unsigned);
+  /* Lookups specialised on the layout of the tree (see `Dispatch`) */
+
+  static constexpr unsigned KeyBits = sizeof(Key) * 8;
+
+  // A radix table with `Entry`s.
+  template <class Entry>
+  struct RadixLookup {
+    SearchBound operator()(const CompactHistTree& tree, const Key key) const {
+      const Entry* table = tree.GetTable<Entry>();
+      const Key prefix = (key - tree.min_key_) >> tree.shift_;
+      assert(prefix + 1 < tree.table_size_);
+      return SearchBound{table[prefix], table[prefix + 1]};
+    }
+  };
+
+  // A tree with narrow entries and 2^`LogNumBins` bins per node. The key is
+  // shifted once, such that the bin of each level is at its top bits, and the
+  // descent is unrolled up to the depth of the key bits. As in `Lookup`,
+  // levels past the bits of the key range only have bin 0; the rare trees
+  // that are even deeper fall back to `Lookup`.
+  template <unsigned LogNumBins>
+  struct TreeLookup {
+    using Entry = TableEntry<unsigned>;
+    static constexpr unsigned MaxDepth = (KeyBits + LogNumBins - 1) / LogNumBins;
+
+    SearchBound operator()(const CompactHistTree& tree, const Key key) const {
+      const unsigned entry = Descend<0>(
+          tree.table_data_, ((key - tree.min_key_) >> tree.key_drop_) << tree.key_shift_, 0);
+      const size_t begin = __builtin_expect(entry & Entry::Leaf, 1)
+                               ? (entry & Entry::Mask)
+                               : tree.Lookup(key, tree.table_data_);
+      // `end` is exclusive.
+      const size_t end = (begin + tree.max_error_ + 1 > tree.num_keys_)
+                            ? tree.num_keys_
+                            : (begin + tree.max_error_ + 1);
+      return SearchBound{begin, end};
+    }
+
+    // Returns the first leaf entry on the path of `key` from `node`, or the
+    // entry at `MaxDepth`.
+    template <unsigned Level>
+    static unsigned Descend(const unsigned* table, const Key key, const size_t node) {
+      const unsigned next =
+          table[(node << LogNumBins) + static_cast<size_t>(key >> (KeyBits - LogNumBins))];
+      if constexpr (Level + 1 < MaxDepth) {
+        if (next & Entry::Leaf) return next;
+        return Descend<Level + 1>(table, key << LogNumBins, next);
+      } else {
+        return next;
+      }
+    }
+  };
+
+  // Any tree, branching on its layout.
+  struct GenericLookup {
+    SearchBound operator()(const CompactHistTree& tree, const Key key) const {
+      if (tree.wide_) return tree.GetSearchBound(key, tree.wide_table_data_);
+      return tree.GetSearchBound(key, tree.table_data_);
+    }
+  };
+
+  template <unsigned LogNumBins, class F>
+  auto DispatchTree(F& f) const {
+    if (log_num_bins_ == LogNumBins) return f(TreeLookup<LogNumBins>());
+    if constexpr (LogNumBins < MaxSpecialisedLogNumBins) {
+      return DispatchTree<LogNumBins + 1>(f);
+    } else {
+      return f(GenericLookup());
+    }
   }
 
- private:
-  static constexpr unsigned Leaf = (1u << 31);
-  static constexpr unsigned Mask = Leaf - 1;
+  template <class Lookup>
+  static SearchBound SearchBoundWith(const CompactHistTree& tree, const Key key) {
+    return Lookup()(tree, key);
+  }
+
+  // Picks the lookup of `GetSearchBound`, once the layout is known.
+  void Specialize() {
+    // The shifts that drop the bits below the last full level of a tree, and
+    // move its top bin to the top bits of a key.
+    key_drop_ = key_shift_ = 0;
+    if (!single_layer_) {
+      const size_t num_bits = shift_ + log_num_bins_;
+      key_drop_ = num_bits % log_num_bins_;
+      key_shift_ = KeyBits - (num_bits - key_drop_);
+    }
+    search_bound_ = Dispatch([](auto lookup) { return &SearchBoundWith<decltype(lookup)>; });
+  }
+
+  template <class Entry>
+  const Entry* GetTable() const {
+    if constexpr (sizeof(Entry) == sizeof(uint64_t)) {
+      return wide_table_data_;
+    } else {
+      return table_data_;
+    }
+  }
 
   // Lookup `key` in tree
-  size_t Lookup(KeyType key) const {
+  template <class Entry>
+  size_t Lookup(Key key, const Entry* table) const {
+    constexpr Entry Leaf = TableEntry<Entry>::Leaf;
+    constexpr Entry Mask = TableEntry<Entry>::Mask;
     key -= min_key_;
     auto width = shift_;
     size_t next = 0;
     do {
       // Get the bin
-      KeyType bin = key >> width;
-      next = table_[(next << log_num_bins_) + bin];
+      Key bin = key >> width;
+      next = table[(next << log_num_bins_) + bin];
 
       // Is it a leaf?
       if (next & Leaf) return next & Mask;
@@ -77,39 +298,100 @@ class CompactHistTree {
   }
 
   bool single_layer_;
-  KeyType min_key_;
-  KeyType max_key_;
+  Key min_key_;
+  Key max_key_;
   size_t num_keys_;
   size_t num_bins_;
   size_t log_num_bins_;
   size_t max_error_;
   size_t shift_;
   
+  // The table is either owned by `table_`, or mapped from an index file. Wide
+  // trees use `wide_table_` and `wide_table_data_` instead.
+  bool wide_ = false;
   std::vector<unsigned> table_;
+  const unsigned* table_data_ = nullptr;
+  std::vector<uint64_t> wide_table_;
+  const uint64_t* wide_table_data_ = nullptr;
+  size_t table_size_ = 0;
+
+  // Set by `Specialize`.
+  unsigned key_drop_ = 0;
+  unsigned key_shift_ = 0;
+  SearchBound (*search_bound_)(const CompactHistTree&, Key) = &SearchBoundWith<GenericLookup>;
+
+  // Scalar members, as stored in an index file.
+  struct Meta {
+    bool single_layer;
+    Key min_key;
+    Key max_key;
+    size_t num_keys;
+    size_t num_bins;
+    size_t log_num_bins;
+    size_t max_error;
+    size_t shift;
+    bool wide;
+  };
+
+  template <typename>
+  friend class PackedHistTree;
+  template <typename>
+  friend class ts::CodeGenerator;
+  template <typename>
+  friend class ts::GeneratedTrieSpline;
 
 
   /* Serialization */
 
   friend class boost::serialization::access;
   template<class Archive>
-  void serialize(Archive & ar, const unsigned int version __attribute__((unused))) {
+  void serialize(Archive & ar, const unsigned int version) {
     // std::cout << "In CompactHistTree::serialize" << std::endl;
     ar & this->single_layer_;
-    ar & this->min_key_;
-    ar & this->max_key_;
+    ts::SerializeKey(ar, this->min_key_);
+    ts::SerializeKey(ar, this->max_key_);
     ar & this->num_keys_;
     ar & this->num_bins_;
     ar & this->log_num_bins_;
     ar & this->max_error_;
     ar & this->shift_;
-    size_t table_size = this->table_.size();
+    if (version >= 1) ar & this->wide_;
+    size_t table_size = this->table_size_;
     ar & table_size;
     // std::cout << "table_size= " << table_size << std::endl;
-    this->table_.resize(table_size);
+    if (Archive::is_loading::value) {
+      if (this->wide_) {
+        this->wide_table_.resize(table_size);
+        this->wide_table_data_ = this->wide_table_.data();
+      } else {
+        this->table_.resize(table_size);
+        this->table_data_ = this->table_.data();
+      }
+      this->table_size_ = table_size;
+    }
     for (size_t idx = 0; idx < table_size; ++idx) {
-      ar & this->table_[idx];
+      if (this->wide_) {
+        ar & const_cast<uint64_t&>(this->wide_table_data_[idx]);
+      } else {
+        ar & const_cast<unsigned&>(this->table_data_[idx]);
+      }
     }
+    if (Archive::is_loading::value) Specialize();
   }
 };
 
-}  // namespace cht
\ No newline at end of file
+}  // namespace cht
+
+namespace boost {
+namespace serialization {
+
+// Version 1: whether the table has 64-bit entries.
+template <class KeyType>
+struct version<ts_cht::CompactHistTree<KeyType>> {
+  typedef mpl::integral_c_tag tag;
+  typedef mpl::int_<1> type;
+  BOOST_STATIC_CONSTANT(int, value = 1);
+};
+
+}  // namespace serialization
+}  // namespace boost
\ No newline at end of file
@@ -10,4 +10,13 @@ struct SearchBound {
   size_t end;  // Exclusive.
 };
 
+// A table entry of a tree is either the index of a child node, or a position
+// with the top bit (`Leaf`) set. Tables have 32-bit entries, unless positions
+// or node indices need more bits.
+template <class Entry>
+struct TableEntry {
+  static constexpr Entry Leaf = Entry(1) << (sizeof(Entry) * 8 - 1);
+  static constexpr Entry Mask = Leaf - 1;
+};
+
 }  // namespace cht
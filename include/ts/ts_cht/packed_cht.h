@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cassert>
+#include <vector>
+
+#include "cht.h"
+#include "common.h"
+
+#include "../bit_packing.h"
+
+namespace ts_cht {
+
+// A `CompactHistTree` whose table entries are bit-packed with the minimal
+// width for this table, instead of 32 bits each.
+template <class KeyType>
+class PackedHistTree {
+ public:
+  using Traits = ts::KeyTraits<KeyType>;
+  using Key = typename Traits::Unsigned;
+
+  PackedHistTree() = default;
+
+  PackedHistTree(const CompactHistTree<KeyType>& cht)
+      : single_layer_(cht.single_layer_),
+        min_key_(cht.min_key_),
+        num_keys_(cht.num_keys_),
+        log_num_bins_(cht.log_num_bins_),
+        max_error_(cht.max_error_),
+        shift_(cht.shift_) {
+    // A radix table only stores positions; a tree additionally needs the leaf
+    // flag, which becomes the top bit of an entry.
+    uint64_t max_value = 0;
+    for (size_t idx = 0; idx < cht.table_size_; ++idx) {
+      max_value = std::max(max_value, cht.GetEntry(idx).first);
+    }
+    const unsigned value_width = bit_packing::ComputeWidth(max_value);
+    width_ = single_layer_ ? value_width : value_width + 1;
+    assert(width_ <= bit_packing::MaxPackedWidth);
+    leaf_ = single_layer_ ? 0 : (1ull << value_width);
+    mask_ = leaf_ - 1;
+
+    table_.resize(bit_packing::NumBytes(cht.table_size_, width_) + sizeof(uint64_t), 0);
+    for (size_t idx = 0; idx < cht.table_size_; ++idx) {
+      const auto [entry, is_leaf] = cht.GetEntry(idx);
+      const uint64_t value = (single_layer_ || !is_leaf) ? entry : (entry | leaf_);
+      bit_packing::Store(table_.data(), width_, idx, value);
+    }
+  }
+
+  // Returns a search bound [`begin`, `end`) around the estimated position.
+  SearchBound GetSearchBound(const KeyType search_key) const {
+    const Key key = Traits::Encode(search_key);
+    if (!single_layer_) {
+      const size_t begin = Lookup(key);
+      // `end` is exclusive.
+      const size_t end = (begin + max_error_ + 1 > num_keys_)
+                            ? num_keys_
+                            : (begin + max_error_ + 1);
+      return SearchBound{begin, end};
+    } else {
+      const Key prefix = (key - min_key_) >> shift_;
+      const size_t begin = bit_packing::Extract(table_.data(), width_, prefix);
+      const size_t end = bit_packing::Extract(table_.data(), width_, prefix + 1);
+      return SearchBound{begin, end};
+    }
+  }
+
+  // Returns the size in bytes.
+  size_t GetSize() const {
+    return sizeof(*this) + table_.size();
+  }
+
+ private:
+  // Lookup `key` in tree
+  size_t Lookup(Key key) const {
+    key -= min_key_;
+    auto width = shift_;
+    size_t next = 0;
+    do {
+      // Get the bin
+      Key bin = key >> width;
+      next = bit_packing::Extract(table_.data(), width_, (next << log_num_bins_) + bin);
+
+      // Is it a leaf?
+      if (next & leaf_) return next & mask_;
+
+      // Prepare for the next level
+      key -= bin << width;
+      width -= log_num_bins_;
+    } while (true);
+  }
+
+  bool single_layer_;
+  Key min_key_;
+  size_t num_keys_;
+  size_t log_num_bins_;
+  size_t max_error_;
+  size_t shift_;
+
+  unsigned width_;
+  uint64_t leaf_;
+  uint64_t mask_;
+  std::vector<uint8_t> table_;
+
+
+  /* Serialization */
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive & ar, const unsigned int version __attribute__((unused))) {
+    ar & this->single_layer_;
+    ar & this->min_key_;
+    ar & this->num_keys_;
+    ar & this->log_num_bins_;
+    ar & this->max_error_;
+    ar & this->shift_;
+    ar & this->width_;
+    ar & this->leaf_;
+    ar & this->mask_;
+    size_t table_size = this->table_.size();
+    ar & table_size;
+    this->table_.resize(table_size);
+    ar & boost::serialization::make_array(this->table_.data(), table_size);
+  }
+};
+
+}  // namespace cht
@@ -29,11 +29,162 @@ double report_t(size_t t_idx, size_t &count_milestone, size_t &last_count_milest
     return time_elapsed;
 }
 
+// Returns the value stored at `index.lower_bound(key)`.
+template <class Index, class Record>
+VALUE_TYPE lower_bound_value(const util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE, Index, Record>& index, KEY_TYPE key) {
+  return index.lower_bound(key)->second;
+}
+
+template <class Index>
+VALUE_TYPE lower_bound_value(const util::ColumnarMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>& index, KEY_TYPE key) {
+  const size_t pos = index.lower_bound(key);
+  return pos < index.size() ? index.value_at(pos) : std::numeric_limits<VALUE_TYPE>::max();
+}
+
+template <class Index>
+VALUE_TYPE lower_bound_value(const util::CompressedMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>& index, KEY_TYPE key) {
+  const size_t pos = index.lower_bound(key);
+  return pos < index.size() ? index.value_at(pos) : std::numeric_limits<VALUE_TYPE>::max();
+}
+
+template <class Index>
+VALUE_TYPE lower_bound_value(const util::DistinctMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>& index, KEY_TYPE key) {
+  const size_t pos = index.lower_bound(key);
+  return pos < index.size() ? index.value_at(pos) : std::numeric_limits<VALUE_TYPE>::max();
+}
+
+VALUE_TYPE lower_bound_value(const util::StringMultiMapTS<VALUE_TYPE>& index, std::string_view key) {
+  const size_t pos = index.lower_bound(key);
+  return pos < index.size() ? index.value_at(pos) : std::numeric_limits<VALUE_TYPE>::max();
+}
+
+// Reports the hit ratio of the position cache, if any.
+template <class Index, class Record>
+void report_cache(const util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE, Index, Record>& index) {
+  const auto* cache = index.GetCache();
+  if (cache == nullptr) return;
+  const size_t hits = cache->GetNumHits();
+  const size_t lookups = hits + cache->GetNumMisses();
+  std::cout << "Cache of " << cache->GetCapacity() << " entries: " << hits << " hits out of "
+            << lookups << " lookups (hit ratio " << static_cast<double>(hits) / std::max<size_t>(1, lookups)
+            << "), saved " << hits << " index probes and last-mile searches" << std::endl;
+}
+
+template <class Index>
+void report_cache(const Index& index __attribute__((unused))) {}
+
+// `load` returns a `std::unique_ptr` to the loaded index.
+template <class Loader, class Query>
+std::vector<double> run_queries(Loader load,
+                                const std::vector<Query>& queries,
+                                const std::vector<uint64_t>& expected_ans,
+                                size_t num_samples, size_t& count_wrong) {
+  // variables for milestone
+  size_t last_count_milestone = 0;
+  size_t count_milestone = 1;
+  long long last_elapsed = 0;
+  std::vector<double> timestamps;
+
+  // start timer
+  auto start_t = std::chrono::high_resolution_clock::now();
+
+  // Load plex from file
+  auto index_ptr = load();
+  const auto& index = *index_ptr;
+
+  // Issue queries and check answers
+  for (size_t t_idx = 0; t_idx < num_samples; t_idx++) {
+    // Query key and answer
+    const Query& key = queries[t_idx];
+    uint64_t answer = expected_ans[t_idx];  
+
+    // Search
+    auto value = lower_bound_value(index, key);
+
+    // Check with answer
+    if (value != answer) {
+      ++count_wrong;
+      // printf("ERROR: incorrect rank: %lu, expected: %lu (key= %lu)\n", value, answer, key);
+    }
+
+    // Step milestone
+    if (t_idx + 1 == count_milestone || t_idx + 1 == num_samples) {
+      timestamps.push_back(report_t(t_idx, count_milestone, last_count_milestone, last_elapsed, start_t));    
+    }
+  }
+  report_cache(index);
+  return timestamps;
+}
+
+template <class Index>
+std::vector<double> run_layout(const std::string& layout,
+                               const std::string& target_db_path,
+                               const std::vector<uint64_t>& queries,
+                               const std::vector<uint64_t>& expected_ans,
+                               size_t num_samples, size_t& count_wrong,
+                               size_t cache_entries) {
+  if (layout == "columnar") {
+    return run_queries(
+        [&] { return std::make_unique<util::ColumnarMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>>(target_db_path); },
+        queries, expected_ans, num_samples, count_wrong);
+  } else if (layout == "compressed") {
+    return run_queries(
+        [&] { return std::make_unique<util::CompressedMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>>(target_db_path); },
+        queries, expected_ans, num_samples, count_wrong);
+  } else if (layout == "distinct") {
+    return run_queries(
+        [&] { return std::make_unique<util::DistinctMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>>(target_db_path); },
+        queries, expected_ans, num_samples, count_wrong);
+  } else {
+    return run_queries(
+        [&] {
+          auto index = std::make_unique<util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>>(target_db_path);
+          if (cache_entries > 0) index->EnableCache(cache_entries, /*count_lookups=*/true);
+          return index;
+        },
+        queries, expected_ans, num_samples, count_wrong);
+  }
+}
+
+// Runs the queries on a plex built with --compact32, for a 32-bit `KeyType` only.
+template <class KeyType>
+std::vector<double> run_compact32(const std::string& target_db_path,
+                                  const std::vector<uint64_t>& queries,
+                                  const std::vector<uint64_t>& expected_ans,
+                                  size_t num_samples, size_t& count_wrong,
+                                  size_t cache_entries) {
+  if constexpr (sizeof(KeyType) == sizeof(uint32_t)) {
+    return run_queries(
+        [&] {
+          auto index = std::make_unique<util::PackedMultiMapTS<KeyType, VALUE_TYPE>>(target_db_path);
+          if (cache_entries > 0) index->EnableCache(cache_entries, /*count_lookups=*/true);
+          return index;
+        },
+        queries, expected_ans, num_samples, count_wrong);
+  } else {
+    std::cerr << "--compact32 requires a 32-bit KEY_TYPE" << std::endl;
+    exit(1);
+  }
+}
+
 /*
  * Required flags:
  * --target_db_path         path to the saved plex
  * --key_path               path to keyset file
  * --out_path               path to save benchmark results
+ *
+ * Optional flags:
+ * --num_samples            number of queries to issue (default: all)
+ * --layout                 data file layout of the saved plex (options: row | columnar | compressed | distinct,
+ *                          default: row)
+ * --compact                the saved plex uses the compact spline and CHT encoding
+ * --compact32              the saved plex uses the 32-bit spline and packed records
+ *                          (32-bit KEY_TYPE, row layout)
+ * --single_file            load the plex from its single index file
+ * --string_keys            the saved plex was built with --keys_file_type=strings; each line of the
+ *                          keyset is the key, a space and the expected answer
+ * --cache_entries          cache the positions of about this many looked up keys in front of
+ *                          the index (row layout only, default: 0, none)
  */
 int main(int argc, char* argv[]) {
   auto flags = parse_flags(argc, argv);
@@ -41,14 +192,28 @@ int main(int argc, char* argv[]) {
   std::string target_db_path = get_required(flags, "target_db_path");
   std::string out_path = get_required(flags, "out_path");
   std::string num_samples_str = get_with_default(flags, "num_samples", "0");  // number of queries
+  std::string layout = get_with_default(flags, "layout", "row");
+  size_t cache_entries = stoull(get_with_default(flags, "cache_entries", "0"));
   size_t num_samples = 0;
   std::stringstream(num_samples_str) >> num_samples;
 
   // Load keyset
   std::vector<uint64_t> queries;
+  std::vector<std::string> string_queries;
   std::vector<uint64_t> expected_ans;
   size_t count_wrong = 0;
-  {
+  const bool string_keys = get_boolean_flag(flags, "string_keys");
+  if (string_keys) {
+      // Keys may hold spaces: the answer follows the last one.
+      std::ifstream query_words_in(key_path);
+      std::string line;
+      while (std::getline(query_words_in, line)) {
+          const size_t space = line.rfind(' ');
+          if (space == std::string::npos) continue;
+          string_queries.push_back(line.substr(0, space));
+          expected_ans.push_back(std::stoull(line.substr(space + 1)));
+      }
+  } else {
       std::ifstream query_words_in(key_path);
       std::string line;
       while (std::getline(query_words_in, line)) {
@@ -65,41 +230,35 @@ int main(int argc, char* argv[]) {
       }   
   }
   if (num_samples == 0) {
-      num_samples = queries.size();
+      num_samples = expected_ans.size();
   }
-  std::cout << "queries.size()= " << queries.size() << "num_samples= " << num_samples << std::endl;
+  std::cout << "queries.size()= " << expected_ans.size() << "num_samples= " << num_samples << std::endl;
 
-  // variables for milestone
-  size_t last_count_milestone = 0;
-  size_t count_milestone = 1;
-  long long last_elapsed = 0;
+  // Load plex from file and issue queries
   std::vector<double> timestamps;
-
-  // start timer
-  auto start_t = std::chrono::high_resolution_clock::now();
-
-  // Load plex from file
-  util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE> index(target_db_path);
-
-  // Issue queries and check answers
-  for (size_t t_idx = 0; t_idx < num_samples; t_idx++) {
-    // Query key and answer
-    uint64_t key = queries[t_idx];
-    uint64_t answer = expected_ans[t_idx];  
-
-    // Search
-    auto it = index.lower_bound(key);
-
-    // Check with answer
-    if (it->second != answer) {
-      ++count_wrong;
-      // printf("ERROR: incorrect rank: %lu (rcv_key= %lu), expected: %lu (key= %lu)\n", it->second, it->first, answer, key);
-    }
-
-    // Step milestone
-    if (t_idx + 1 == count_milestone || t_idx + 1 == num_samples) {
-      timestamps.push_back(report_t(t_idx, count_milestone, last_count_milestone, last_elapsed, start_t));    
-    }
+  if (string_keys) {
+    timestamps = run_queries(
+        [&] { return std::make_unique<util::StringMultiMapTS<VALUE_TYPE>>(target_db_path); },
+        string_queries, expected_ans, num_samples, count_wrong);
+  } else if (get_boolean_flag(flags, "single_file")) {
+    using Map = util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE>;
+    timestamps = run_queries(
+        [&] {
+          auto index = std::make_unique<Map>(std::make_shared<const mmap_struct::IndexFile>(
+              Map::make_index_path(target_db_path)));
+          if (cache_entries > 0) index->EnableCache(cache_entries, /*count_lookups=*/true);
+          return index;
+        },
+        queries, expected_ans, num_samples, count_wrong);
+  } else if (get_boolean_flag(flags, "compact32")) {
+    timestamps = run_compact32<KEY_TYPE>(target_db_path, queries, expected_ans, num_samples,
+                                         count_wrong, cache_entries);
+  } else if (get_boolean_flag(flags, "compact")) {
+    timestamps = run_layout<ts::CompactTrieSpline<KEY_TYPE>>(
+        layout, target_db_path, queries, expected_ans, num_samples, count_wrong, cache_entries);
+  } else {
+    timestamps = run_layout<ts::TrieSpline<KEY_TYPE>>(
+        layout, target_db_path, queries, expected_ans, num_samples, count_wrong, cache_entries);
   }
   if (count_wrong > 0) {
     std::cout << "ERROR: there are " << count_wrong << " incorrect ranks" << std::endl;
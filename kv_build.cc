@@ -9,27 +9,221 @@
 #include <iomanip>
 
 #include "bench_utils.h"
+#include "build_utils.h"
+#include "include/ts/learned_sort.h"
 
 // Modify these if running your own workload
 #define KEY_TYPE uint64_t
 #define VALUE_TYPE uint64_t
 
+template <class Index, class Element, class... Args>
+void build_and_check(const std::vector<Element>& elements,
+                     size_t max_error, const std::string& db_path,
+                     bool single_file = false, Args... args) {
+  {
+    // Create PLEX and bulk load
+    auto bulk_load_start_time = std::chrono::high_resolution_clock::now();
+    Index index(elements, max_error, db_path, args...);
+    auto bulk_load_end_time = std::chrono::high_resolution_clock::now();
+    auto bulk_load_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            bulk_load_end_time - bulk_load_start_time)
+                            .count();
+    std::cout << "Bulk load completed in " << bulk_load_time / 1e9 << " s" << std::endl;
+    std::cout << "Index size " << index.GetSizeInByte() << " bytes" << std::endl;
+
+    // Serialize and save to file
+    index.save_to_file(); 
+    if constexpr (std::is_same_v<Index, util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE>>) {
+      if (single_file) index.save_to_index_file();
+    }
+  }
+
+  // Test load plex from file
+  {
+    Index index(db_path);
+    std::cout << "Check sum_up of idx= 0, sum= " << index.sum_up(elements[0].first) << std::endl;
+    std::cout << "Check sum_up of idx= 10, sum= " << index.sum_up(elements[10].first) << std::endl;
+    std::cout << "Check sum_up of idx= 100, sum= " << index.sum_up(elements[100].first) << std::endl;
+    std::cout << "Check sum_up of idx= 1000, sum= " << index.sum_up(elements[1000].first) << std::endl;
+    std::cout << "Tested loaded from " << db_path << std::endl;
+  }
+
+  // Test load plex from the single index file
+  if constexpr (std::is_same_v<Index, util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE>>) {
+    if (single_file) {
+      auto file = std::make_shared<const mmap_struct::IndexFile>(Index::make_index_path(db_path));
+      if (!file->VerifyChecksums()) exit(1);
+      Index index(file);
+      std::cout << "Check sum_up of idx= 1000, sum= " << index.sum_up(elements[1000].first) << std::endl;
+      std::cout << "Tested loaded from " << Index::make_index_path(db_path) << std::endl;
+    }
+  }
+}
+
+template <class Index>
+void build_layout(const std::string& layout,
+                  const std::vector<std::pair<KEY_TYPE, VALUE_TYPE>>& elements,
+                  size_t max_error, const std::string& db_path, bool single_file,
+                  size_t filter_bits_per_key, const std::vector<KEY_TYPE>& query_sample) {
+  if (layout == "columnar") {
+    build_and_check<util::ColumnarMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>>(elements, max_error, db_path);
+  } else if (layout == "compressed") {
+    build_and_check<util::CompressedMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>>(elements, max_error, db_path);
+  } else if (layout == "distinct") {
+    build_and_check<util::DistinctMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>>(elements, max_error, db_path);
+  } else {
+    build_and_check<util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE, Index>>(
+        elements, max_error, db_path, single_file, filter_bits_per_key, query_sample);
+  }
+}
+
+// Builds with a `ts::TrieSpline32` and packed records, for a 32-bit `KeyType` only.
+template <class KeyType>
+void build_compact32(const std::vector<std::pair<KeyType, VALUE_TYPE>>& elements,
+                     size_t max_error, const std::string& db_path,
+                     size_t filter_bits_per_key, const std::vector<KeyType>& query_sample) {
+  if constexpr (sizeof(KeyType) == sizeof(uint32_t)) {
+    build_and_check<util::PackedMultiMapTS<KeyType, VALUE_TYPE>>(
+        elements, max_error, db_path, false, filter_bits_per_key, query_sample);
+  } else {
+    std::cerr << "--compact32 requires a 32-bit KEY_TYPE" << std::endl;
+    exit(1);
+  }
+}
+
 /*
  * Required flags:
  * --keys_file              path to the file that contains keys
- * --keys_file_type         file type of keys_file (options: binary | text | sosd)
+ * --keys_file_type         file type of keys_file (options: binary | text | sosd | strings),
+ *                          strings holds one byte string key per line and builds a string plex
  * --total_num_keys         total number of keys in the keys file
  * --db_path                path to save built plex
  * --max_error              PLEX's spline max error
+ *
+ * Optional flags:
+ * --layout                 data file layout (options: row | columnar | compressed | distinct,
+ *                          default: row), distinct indexes only distinct keys, for heavy duplicates
+ * --compact                store the spline and CHT in the compact encoding
+ * --compact32              store a 32-bit spline, and the data as packed records, for a 32-bit
+ *                          KEY_TYPE and fewer than 2^32 keys (row layout only)
+ * --single_file            additionally save data and index into a single index file
+ *                          (row layout without --compact or --compact32 only)
+ * --filter_bits_per_key    build a Bloom filter over the keys with this many bits per key, so that
+ *                          lookups of absent keys skip the data (row layout without --streaming
+ *                          only, default: 0, none)
+ * --query_sample           keyset file (as for kv_benchmark) of sampled lookups; the spline gets
+ *                          tighter errors where they are frequent, in about the same size
+ *                          (row layout only)
+ * --streaming              stream keys from keys_file and build within --memory_budget_mb,
+ *                          sorting unsorted input externally (row layout without --compact or
+ *                          --compact32 only)
+ * --memory_budget_mb       memory budget of --streaming for buffers and sorted runs (default: 1024)
+ * --checkpoint_every       with --streaming, checkpoint the build every this many keys (default: 0, never)
+ * --resume                 with --streaming, resume from the checkpoint under db_path, if any;
+ *                          fails if it was saved for another keys_file, total_num_keys or max_error
+ * --direct_io              write data files with O_DIRECT, bypassing the page cache
+ * --write_threads          number of threads writing data files (default: one per hardware thread)
+ * --sort                   in-memory sort of the keys (options: radix | learned, default: radix),
+ *                          learned partitions by a spline over a sample of the keys
  */
 int main(int argc, char* argv[]) {
   auto flags = parse_flags(argc, argv);
   std::string keys_file_path = get_required(flags, "keys_file");
   std::string keys_file_type = get_required(flags, "keys_file_type");
-  auto total_num_keys = stoi(get_required(flags, "total_num_keys"));
+  size_t total_num_keys = stoull(get_required(flags, "total_num_keys"));
   std::string db_path = get_required(flags, "db_path");
-  size_t max_error = stoi(get_required(flags, "max_error"));
+  size_t max_error = stoull(get_required(flags, "max_error"));
+  std::string layout = get_with_default(flags, "layout", "row");
+  bool single_file = get_boolean_flag(flags, "single_file");
+  std::string sort = get_with_default(flags, "sort", "radix");
+  size_t filter_bits_per_key = stoull(get_with_default(flags, "filter_bits_per_key", "0"));
+  std::string query_sample_path = get_with_default(flags, "query_sample", "");
   std::cout << "Using max_error= " << max_error << std::endl;
+  if (layout != "row" && layout != "columnar" && layout != "compressed" && layout != "distinct") {
+    std::cerr << "--layout must be either 'row' or 'columnar' or 'compressed' or 'distinct'" << std::endl;
+    return 1;
+  }
+  if (filter_bits_per_key > 0 && layout != "row") {
+    std::cerr << "--filter_bits_per_key requires --layout=row" << std::endl;
+    return 1;
+  }
+  if (!query_sample_path.empty() && layout != "row") {
+    std::cerr << "--query_sample requires --layout=row" << std::endl;
+    return 1;
+  }
+  if (sort != "radix" && sort != "learned") {
+    std::cerr << "--sort must be either 'radix' or 'learned'" << std::endl;
+    return 1;
+  }
+  bool compact32 = get_boolean_flag(flags, "compact32");
+  if (single_file && (layout != "row" || get_boolean_flag(flags, "compact") || compact32)) {
+    std::cerr << "--single_file requires --layout=row without --compact or --compact32" << std::endl;
+    return 1;
+  }
+  if (compact32 && (layout != "row" || get_boolean_flag(flags, "compact"))) {
+    std::cerr << "--compact32 requires --layout=row without --compact" << std::endl;
+    return 1;
+  }
+
+  mmap_struct::DefaultWriteOptions().direct_io = get_boolean_flag(flags, "direct_io");
+  mmap_struct::DefaultWriteOptions().num_threads = stoull(get_with_default(flags, "write_threads", "0"));
+
+  // Index byte string keys
+  if (keys_file_type == "strings") {
+    if (layout != "row" || get_boolean_flag(flags, "compact") || compact32 || single_file ||
+        filter_bits_per_key > 0 || !query_sample_path.empty() || get_boolean_flag(flags, "streaming")) {
+      std::cerr << "--keys_file_type=strings supports none of --layout, --compact, --compact32, "
+                << "--single_file, --filter_bits_per_key, --query_sample and --streaming" << std::endl;
+      return 1;
+    }
+    std::ifstream is(keys_file_path);
+    if (!is.is_open()) {
+      std::cerr << "unable to open " << keys_file_path << std::endl;
+      return 1;
+    }
+    std::vector<std::pair<std::string, VALUE_TYPE>> elements;
+    std::string line;
+    while (elements.size() < total_num_keys && std::getline(is, line)) {
+      elements.push_back({line, elements.size()});
+    }
+    std::stable_sort(elements.begin(), elements.end(),
+                     [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    std::cout << "Loaded dataset of size " << elements.size() << std::endl;
+    fs::create_directories(db_path);
+    build_and_check<util::StringMultiMapTS<VALUE_TYPE>>(elements, max_error, db_path);
+    return 0;
+  }
+
+  // Stream keys from file directly into data file and index
+  if (get_boolean_flag(flags, "streaming")) {
+    if (layout != "row" || get_boolean_flag(flags, "compact") || compact32) {
+      std::cerr << "--streaming requires --layout=row without --compact or --compact32" << std::endl;
+      return 1;
+    }
+    if (!query_sample_path.empty()) {
+      std::cerr << "--query_sample is not supported with --streaming" << std::endl;
+      return 1;
+    }
+    if (filter_bits_per_key > 0) {
+      std::cerr << "--filter_bits_per_key is not supported with --streaming" << std::endl;
+      return 1;
+    }
+    size_t memory_budget = stoull(get_with_default(flags, "memory_budget_mb", "1024")) << 20;
+    auto build_start_time = std::chrono::high_resolution_clock::now();
+    util::StreamingBuilderTS<KEY_TYPE, VALUE_TYPE> builder(
+        keys_file_path, keys_file_type, total_num_keys, max_error, db_path, memory_budget,
+        stoull(get_with_default(flags, "checkpoint_every", "0")), get_boolean_flag(flags, "resume"));
+    builder.Build();
+    auto build_end_time = std::chrono::high_resolution_clock::now();
+    std::cout << "Streaming build completed in "
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(build_end_time - build_start_time).count() / 1e9
+              << " s" << std::endl;
+
+    util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE> index(db_path);
+    std::cout << "Check sum_up of min key, sum= " << index.sum_up(builder.min_key()) << std::endl;
+    std::cout << "Tested loaded from " << db_path << std::endl;
+    return 0;
+  }
 
   // Prepare directory
   if (!fs::is_directory(db_path) || !fs::exists(db_path)) {
@@ -54,39 +248,41 @@ int main(int argc, char* argv[]) {
 
   // Combine bulk loaded keys with their ranks
   auto elements = std::vector<std::pair<KEY_TYPE, VALUE_TYPE>>(total_num_keys);
-  for (int i = 0; i < total_num_keys; i++) {
+  for (size_t i = 0; i < total_num_keys; i++) {
     if (i % (total_num_keys / 10) == 0) {
       std::cout << "idx= " << i << ": key= " << keys[i] << std::endl;
     }
     elements[i].first = keys[i];
     elements[i].second = i;
   }
-  std::sort(elements.begin(), elements.end(),
-            [](auto const& a, auto const& b) { return a.first < b.first; });
+  auto sort_start_time = std::chrono::high_resolution_clock::now();
+  if (sort == "learned") {
+    fs::path model_path = fs::path(db_path) / "sort_model";
+    ts::LearnedSorter<KEY_TYPE, VALUE_TYPE>(model_path).Sort(elements);
+    fs::remove_all(model_path);
+  } else {
+    rs::RadixSort(elements);
+  }
+  auto sort_end_time = std::chrono::high_resolution_clock::now();
+  std::cout << "Sorted dataset in "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(sort_end_time - sort_start_time).count() / 1e9
+            << " s" << std::endl;
   delete[] keys;
   std::cout << "Loaded dataset of size " << total_num_keys << std::endl;
 
-  {
-    // Create PLEX and bulk load
-    auto bulk_load_start_time = std::chrono::high_resolution_clock::now();
-    util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE> index(elements, max_error, db_path);
-    auto bulk_load_end_time = std::chrono::high_resolution_clock::now();
-    auto bulk_load_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
-                            bulk_load_end_time - bulk_load_start_time)
-                            .count();
-    std::cout << "Bulk load completed in " << bulk_load_time / 1e9 << " s" << std::endl;
-
-    // Serialize and save to file
-    index.save_to_file(); 
+  std::vector<KEY_TYPE> query_sample;
+  if (!query_sample_path.empty()) {
+    query_sample = load_keyset_keys<KEY_TYPE>(query_sample_path);
+    std::cout << "Loaded query sample of size " << query_sample.size() << std::endl;
   }
 
-  // Test load plex from file
-  {
-    util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE> index(db_path);
-    std::cout << "Check sum_up of idx= 0, sum= " << index.sum_up(elements[0].first) << std::endl;
-    std::cout << "Check sum_up of idx= 10, sum= " << index.sum_up(elements[10].first) << std::endl;
-    std::cout << "Check sum_up of idx= 100, sum= " << index.sum_up(elements[100].first) << std::endl;
-    std::cout << "Check sum_up of idx= 1000, sum= " << index.sum_up(elements[1000].first) << std::endl;
-    std::cout << "Tested loaded from " << db_path << std::endl;
+  if (compact32) {
+    build_compact32(elements, max_error, db_path, filter_bits_per_key, query_sample);
+  } else if (get_boolean_flag(flags, "compact")) {
+    build_layout<ts::CompactTrieSpline<KEY_TYPE>>(layout, elements, max_error, db_path, single_file,
+                                                  filter_bits_per_key, query_sample);
+  } else {
+    build_layout<ts::TrieSpline<KEY_TYPE>>(layout, elements, max_error, db_path, single_file,
+                                           filter_bits_per_key, query_sample);
   }
 }
@@ -0,0 +1,108 @@
+/*
+ * Generate a header with the lookup of a saved plex specialised on its parameters (see
+ * `ts::GeneratedTrieSpline`), and a program that cross-checks it against the generic lookup.
+ *
+ * Examples:
+    ./kv_codegen --target_db_path=tmp/plex/fb_1M_uint64 --out_path=tmp/fb_1M_uint64_index.h --test_out_path=tmp/fb_1M_uint64_check.cc
+    g++ -std=c++17 -O3 -march=native -I. -Iinclude -Itmp tmp/fb_1M_uint64_check.cc -o fb_1M_uint64_check -lboost_serialization
+    ./fb_1M_uint64_check tmp/plex/fb_1M_uint64
+ */
+
+#include "bench_utils.h"
+#include "include/ts/codegen.h"
+
+
+// Modify these if running your own workload
+#define KEY_TYPE uint64_t
+#define VALUE_TYPE uint64_t
+
+using Map = util::NonOwningMultiMapTS<KEY_TYPE, VALUE_TYPE>;
+using Generator = ts::CodeGenerator<KEY_TYPE>;
+
+// Writes a program that loads a plex with the generated lookup
+// `name_space::name` from `header`, and exits with failure if any of its
+// search bounds differs from the generic spline's.
+void write_cross_check(const std::string& header, const std::string& name_space,
+                       const std::string& name, std::ostream& out) {
+  const std::string index = name_space + "::" + name;
+  out << "// Generated by kv_codegen: cross-checks " << index << " against ts::TrieSpline.\n"
+      << "//\n"
+      << "// Usage: <program> <target_db_path> [--single_file] [num_probes]\n\n"
+      << "#include \"bench_utils.h\"\n"
+      << "#include \"" << header << "\"\n\n"
+      << "int main(int argc, char* argv[]) {\n"
+      << "  if (argc < 2) {\n"
+      << "    std::cerr << \"usage: \" << argv[0] << \" <target_db_path> [--single_file] [num_probes]\" << std::endl;\n"
+      << "    return EXIT_FAILURE;\n"
+      << "  }\n"
+      << "  using Map = util::NonOwningMultiMapTS<" << Generator::TypeName<KEY_TYPE>() << ", "
+      << Generator::TypeName<VALUE_TYPE>() << ", " << index << ">;\n"
+      << "  const bool single_file = argc > 2 && std::string(argv[2]) == \"--single_file\";\n"
+      << "  const size_t num_probes = argc > 2 + single_file ? std::stoull(argv[2 + single_file]) : 1000000;\n"
+      << "  const auto map = single_file ? std::make_unique<Map>(std::make_shared<const mmap_struct::IndexFile>(\n"
+      << "                                     Map::make_index_path(argv[1])))\n"
+      << "                               : std::make_unique<Map>(argv[1]);\n"
+      << "  const size_t num_mismatches = map->GetIndex().CrossCheck(num_probes);\n"
+      << "  if (num_mismatches > 0) {\n"
+      << "    std::cerr << \"ERROR: \" << num_mismatches << \" lookups differ from ts::TrieSpline\" << std::endl;\n"
+      << "    return EXIT_FAILURE;\n"
+      << "  }\n"
+      << "  std::cout << \"" << index << " matches ts::TrieSpline\" << std::endl;\n"
+      << "  return 0;\n"
+      << "}\n";
+}
+
+/*
+ * Required flags:
+ * --target_db_path         path to the saved plex (row layout without --compact)
+ * --out_path               path to write the header to
+ *
+ * Optional flags:
+ * --single_file            load the plex from its single index file
+ * --namespace              namespace of the generated lookup (default: plex_generated)
+ * --name                   name of the generated index type (default: Index)
+ * --max_table_entries      embed the CHT table in the header if it has at most this many entries
+ *                          (default: 4096)
+ * --test_out_path          path to write a program to, which cross-checks the generated lookup
+ *                          against the generic one on the saved plex
+ */
+int main(int argc, char* argv[]) {
+  auto flags = parse_flags(argc, argv);
+  std::string target_db_path = get_required(flags, "target_db_path");
+  std::string out_path = get_required(flags, "out_path");
+  std::string name_space = get_with_default(flags, "namespace", "plex_generated");
+  std::string name = get_with_default(flags, "name", "Index");
+  size_t max_table_entries = stoull(get_with_default(flags, "max_table_entries", "4096"));
+  std::string test_out_path = get_with_default(flags, "test_out_path", "");
+
+  // Load plex from file
+  std::unique_ptr<Map> map;
+  if (get_boolean_flag(flags, "single_file")) {
+    map = std::make_unique<Map>(
+        std::make_shared<const mmap_struct::IndexFile>(Map::make_index_path(target_db_path)));
+  } else {
+    map = std::make_unique<Map>(target_db_path);
+  }
+
+  // Write the header
+  {
+    std::ofstream out(out_path);
+    if (!out.is_open()) {
+      std::cerr << "unable to open " << out_path << std::endl;
+      return 1;
+    }
+    Generator::EmitHeader(map->GetIndex(), name_space, name, max_table_entries, out);
+    std::cout << "Wrote " << name_space << "::" << name << " to " << out_path << std::endl;
+  }
+
+  // Write the cross-check
+  if (!test_out_path.empty()) {
+    std::ofstream out(test_out_path);
+    if (!out.is_open()) {
+      std::cerr << "unable to open " << test_out_path << std::endl;
+      return 1;
+    }
+    write_cross_check(fs::path(out_path).filename(), name_space, name, out);
+    std::cout << "Wrote cross-check to " << test_out_path << std::endl;
+  }
+}